@@ -0,0 +1,73 @@
+#ifndef JOB_SCHEDULER_H_
+#define JOB_SCHEDULER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fishcat
+{
+    // Runs a graph of jobs on a fixed set of worker threads. Every worker owns a deque and takes its
+    // newest ready job first, an idle worker steals the oldest job of another one. A job is ready once
+    // all its dependencies succeeded, and goes to the worker which finished the last of them; it is
+    // skipped if one of them failed.
+    class JobScheduler
+    {
+    public:
+        enum JobState
+        {
+            JOB_PENDING,
+            JOB_SUCCEEDED,
+            JOB_FAILED,
+            JOB_SKIPPED
+        };
+
+        // Returns false for a failed job, an exception fails the job as well.
+        typedef std::function<bool()> Task;
+
+        // The index of the new job, the dependencies are jobs added before it.
+        int AddJob(const Task &task, const std::vector<int> &dependencies = std::vector<int>());
+
+        // Blocks until every job ran or was skipped. worker_init runs first on every worker thread,
+        // e.g. for its thread budget.
+        void Run(int workers, const std::function<void(int)> &worker_init = nullptr);
+
+        int JobCount() const { return (int)jobs_.size(); }
+        JobState State(int job) const { return jobs_[job].state; }
+        double Seconds(int job) const { return jobs_[job].seconds; } // run time, 0 if it did not run.
+
+    private:
+        struct Job
+        {
+            Task task;
+            std::vector<int> dependents;
+            int waiting; // dependencies not finished yet.
+            JobState state;
+            double seconds;
+        };
+
+        struct WorkerQueue
+        {
+            std::mutex mutex;
+            std::deque<int> jobs;
+        };
+
+        void WorkerLoop(int worker);
+        void Push(int worker, int job);
+        bool Pop(int worker, int &job);
+        // Records the end of the job, called with mutex_ held.
+        void Finish(int worker, int job, JobState state);
+
+        std::vector<Job> jobs_;
+        std::vector<std::unique_ptr<WorkerQueue>> queues_;
+        std::mutex mutex_; // guards the job states, queued_ and remaining_.
+        std::condition_variable ready_;
+        int queued_ = 0;
+        int remaining_ = 0;
+    };
+}
+
+#endif
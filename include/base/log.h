@@ -1,9 +1,73 @@
 #ifndef LOG_H_
 #define LOG_H_
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
 // Third party
 #include <glog/logging.h>
 
+#include "base/string_format.h"
+
 void InitialGoogleLog(char **argv);
 
-#endif
\ No newline at end of file
+namespace fishcat
+{
+    // Lines of one thread, only the writer thread ever contends for the mutex.
+    struct ItemLogBuffer
+    {
+        std::mutex mutex;
+        std::string text;
+        long thread_id;
+    };
+
+    // The buffer of the calling thread, registered with the writer on the first use.
+    ItemLogBuffer &CurrentItemLogBuffer();
+    // glog-like "I1019 12:34:56.123456 tid] " prefix.
+    void AppendItemLogPrefix(std::string &text, long thread_id);
+    // Blocks until every buffered line is written, before a summary logged through glog.
+    void FlushItemLog();
+
+    // Per-item message of the hot loops, formatted as stringformat::Format. The line goes to the buffer
+    // of the calling thread and a writer thread drains all the buffers to stderr, so the OpenMP loops
+    // never meet on the glog lock. Warnings and errors stay with LOG.
+    template <typename... Args>
+    void LogItem(const char *format, const Args &...args)
+    {
+        if (FLAGS_minloglevel > google::GLOG_INFO)
+            return;
+        ItemLogBuffer &buffer = CurrentItemLogBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        AppendItemLogPrefix(buffer.text, buffer.thread_id);
+        stringformat::FormatTo(buffer.text, format, args...);
+        buffer.text.push_back('\n');
+    }
+
+    // Counts the items of a loop from any thread and logs "what: done/total, rate" at most once per
+    // interval, so every item can report without flooding the log.
+    class ProgressLog
+    {
+    public:
+        // a total of 0 is unknown.
+        explicit ProgressLog(const std::string &what, int64_t total = 0, double interval = 1.0);
+
+        // One atomic increment and a clock read when no line is due.
+        void Step(int64_t items = 1);
+        // The final count through glog.
+        void Finish();
+
+    private:
+        void Report(int64_t done, int64_t now);
+
+        std::string what_;
+        int64_t total_;
+        int64_t interval_;
+        int64_t start_;
+        std::atomic<int64_t> done_;
+        std::atomic<int64_t> next_report_;
+    };
+}
+
+#endif
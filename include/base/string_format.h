@@ -3,50 +3,17 @@
 
 #pragma once
 
-#include <string>
-#include <vector>
-#include <stdlib.h>
-#include <iostream>
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 #include <sstream>
-#include <iomanip>
+#include <tuple>
+#include <type_traits>
 
 namespace stringformat
 {
-    class ArgBase
-    {
-    public:
-        ArgBase() {}
-        virtual ~ArgBase() {}
-        virtual void Format(std::ostringstream &ss, const std::string &fmt) = 0;
-    };
-
-    template <class T>
-    class Arg : public ArgBase
-    {
-    public:
-        Arg(T arg) : m_arg(arg) {}
-        virtual ~Arg() {}
-        virtual void Format(std::ostringstream &ss, const std::string &fmt)
-        {
-            ss << m_arg;
-        }
-
-    private:
-        T m_arg;
-    };
-
-    class ArgArray : public std::vector<ArgBase *>
-    {
-    public:
-        ArgArray() {}
-        ~ArgArray()
-        {
-            std::for_each(begin(), end(), [](ArgBase *p)
-                          { delete p; });
-        }
-    };
-
     // added by cvrs-group
     static std::string StringTrimExtension(const std::string input_string)
     {
@@ -78,99 +45,203 @@ namespace stringformat
         return former_string + "/" + latter_string;
     }
 
-    static void FormatItem(std::ostringstream &ss, const std::string &item, const ArgArray &args)
+    namespace internal
     {
-        int index = 0;
-        int alignment = 0;
-        std::string fmt;
+        // The arguments are appended straight to the output, numbers through a stack buffer, so a
+        // reused output string formats without any allocation once it has grown.
+        inline void AppendArgument(std::string &out, const std::string &arg) { out.append(arg); }
+        inline void AppendArgument(std::string &out, const char *arg) { out.append(arg ? arg : "(null)"); }
+        inline void AppendArgument(std::string &out, char arg) { out.push_back(arg); }
+        // as the stream, int8_t and uint8_t are characters.
+        inline void AppendArgument(std::string &out, signed char arg) { out.push_back((char)arg); }
+        inline void AppendArgument(std::string &out, unsigned char arg) { out.push_back((char)arg); }
+        inline void AppendArgument(std::string &out, bool arg) { out.push_back(arg ? '1' : '0'); }
+
+        template <class T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        AppendArgument(std::string &out, T arg)
+        {
+            char buffer[32];
+            out.append(buffer, snprintf(buffer, sizeof(buffer), "%lld", (long long)arg));
+        }
 
-        char *endptr = nullptr;
-        index = strtol(&item[0], &endptr, 10);
-        if (index < 0 || index >= args.size())
+        template <class T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        AppendArgument(std::string &out, T arg)
         {
-            return;
+            char buffer[32];
+            out.append(buffer, snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)arg));
         }
 
-        if (*endptr == ',')
+        template <class T>
+        typename std::enable_if<std::is_enum<T>::value>::type AppendArgument(std::string &out, T arg)
         {
-            alignment = strtol(endptr + 1, &endptr, 10);
-            if (alignment > 0)
-            {
-                ss << std::right << std::setw(alignment);
-            }
-            else if (alignment < 0)
-            {
-                ss << std::left << std::setw(-alignment);
-            }
+            // promoted, so an enum over a character type is still a number.
+            AppendArgument(out, +(typename std::underlying_type<T>::type)arg);
         }
 
-        if (*endptr == ':')
+        // %g with 6 digits is what an ostream writes by default.
+        template <class T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type AppendArgument(std::string &out, T arg)
         {
-            fmt = endptr + 1;
+            char buffer[32];
+            out.append(buffer, snprintf(buffer, sizeof(buffer), "%g", (double)arg));
         }
 
-        args[index]->Format(ss, fmt);
+        // any other type goes through its stream operator, into a stream kept per thread.
+        template <class T>
+        typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value>::type
+        AppendArgument(std::string &out, const T &arg)
+        {
+            static thread_local std::ostringstream ss;
+            ss.str(std::string());
+            ss.clear();
+            ss << arg;
+            out.append(ss.str());
+        }
 
-        return;
-    }
+        inline void AppendIndexed(std::string &, int) {}
 
-    template <class T>
-    static void Transfer(ArgArray &argArray, T t)
-    {
-        argArray.push_back(new Arg<T>(t));
-    }
+        template <class T, typename... Rest>
+        void AppendIndexed(std::string &out, int index, const T &arg, const Rest &...rest)
+        {
+            if (index == 0)
+                AppendArgument(out, arg);
+            else
+                AppendIndexed(out, index - 1, rest...);
+        }
 
-    template <class T, typename... Args>
-    static void Transfer(ArgArray &argArray, T t, Args &&...args)
-    {
-        Transfer(argArray, t);
-        Transfer(argArray, args...);
-    }
+        inline int ParseInt(const char *&p, const char *end)
+        {
+            bool negative = p < end && *p == '-';
+            if (negative)
+                p++;
+            int value = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; p++)
+                value = value * 10 + (*p - '0');
+            return negative ? -value : value;
+        }
 
-    template <typename... Args>
-    std::string Format(const std::string &format, Args &&...args)
-    {
-        if (sizeof...(args) == 0)
+        // {index[,alignment][:fmt]}, a negative alignment pads on the right. The fmt part is accepted
+        // and ignored as it always was.
+        template <typename... Args>
+        void FormatItem(std::string &out, const char *item, const char *end, const Args &...args)
         {
-            return format;
+            const char *p = item;
+            const int index = ParseInt(p, end);
+            if (p == item || index < 0 || index >= (int)sizeof...(args))
+                return;
+
+            int alignment = 0;
+            if (p < end && *p == ',')
+                alignment = ParseInt(++p, end);
+
+            const size_t begin = out.size();
+            AppendIndexed(out, index, args...);
+            const size_t width = out.size() - begin, padded = (size_t)std::abs(alignment);
+            if (width >= padded)
+                return;
+            if (alignment > 0)
+                out.insert(begin, padded - width, ' ');
+            else
+                out.append(padded - width, ' ');
         }
 
-        ArgArray argArray;
-        Transfer(argArray, args...);
-        size_t start = 0;
-        size_t pos = 0;
-        std::ostringstream ss;
-        while (true)
+        template <typename... Args>
+        void FormatRange(std::string &out, const char *format, const char *format_end, const Args &...args)
         {
-            pos = format.find('{', start);
-            if (pos == std::string::npos)
+            if (sizeof...(args) == 0)
             {
-                ss << format.substr(start);
-                break;
+                out.append(format, format_end);
+                return;
             }
 
-            ss << format.substr(start, pos - start);
-            if (format[pos + 1] == '{')
+            const char *start = format;
+            while (true)
             {
-                ss << '{';
-                start = pos + 2;
-                continue;
+                const char *pos = std::find(start, format_end, '{');
+                out.append(start, pos);
+                if (pos == format_end)
+                    break;
+
+                if (pos + 1 < format_end && pos[1] == '{')
+                {
+                    out.push_back('{');
+                    start = pos + 2;
+                    continue;
+                }
+
+                const char *close = std::find(pos + 1, format_end, '}');
+                if (close == format_end)
+                {
+                    out.append(pos, format_end);
+                    break;
+                }
+
+                FormatItem(out, pos + 1, close, args...);
+                start = close + 1;
             }
+        }
 
-            start = pos + 1;
-            pos = format.find('}', start);
-            if (pos == std::string::npos)
+        // Placeholders checked at compile time by STRING_FORMAT: every item is closed and its index
+        // names an argument.
+        constexpr bool IsValidFormat(const char *format, int argument_count)
+        {
+            for (int i = 0; format[i] != '\0'; i++)
             {
-                ss << format.substr(start - 1);
-                break;
+                if (format[i] != '{')
+                    continue;
+                if (format[i + 1] == '{')
+                {
+                    i++;
+                    continue;
+                }
+                int index = 0, digits = 0;
+                for (i++; format[i] >= '0' && format[i] <= '9'; i++, digits++)
+                    index = index * 10 + (format[i] - '0');
+                if (digits == 0 || index >= argument_count)
+                    return false;
+                while (format[i] != '}')
+                {
+                    if (format[i] == '\0')
+                        return false;
+                    i++;
+                }
             }
-
-            FormatItem(ss, format.substr(start, pos - start), argArray);
-            start = pos + 1;
+            return true;
         }
+    }
 
-        return ss.str();
+    // Appends the formatted text to out, a string reused across calls formats without allocating.
+    template <typename... Args>
+    void FormatTo(std::string &out, const char *format, const Args &...args)
+    {
+        internal::FormatRange(out, format, format + strlen(format), args...);
+    }
+
+    template <typename... Args>
+    void FormatTo(std::string &out, const std::string &format, const Args &...args)
+    {
+        internal::FormatRange(out, format.data(), format.data() + format.size(), args...);
+    }
+
+    template <typename... Args>
+    std::string Format(const std::string &format, Args &&...args)
+    {
+        std::string out;
+        out.reserve(format.size() + 16 * sizeof...(args));
+        FormatTo(out, format, args...);
+        return out;
     }
 }
 
+// Format with a literal format string, an item without its argument fails to compile.
+#define STRING_FORMAT(format, ...)                                                                                    \
+    ([&]() {                                                                                                          \
+        static_assert(::stringformat::internal::IsValidFormat(                                                       \
+                          format, std::tuple_size<decltype(std::forward_as_tuple(__VA_ARGS__))>::value),             \
+                      "format item without an argument: " format);                                                   \
+        return ::stringformat::Format(format, __VA_ARGS__);                                                          \
+    }())
+
 #endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef WORKER_PROCESS_H_
+#define WORKER_PROCESS_H_
+
+#include <string>
+#include <vector>
+
+namespace fishcat
+{
+    // Runs this executable once per argument list (argv[1]...) as child processes, all at once, and
+    // waits for them. Returns false if one could not be started or did not exit with EXIT_SUCCESS.
+    bool RunWorkerProcesses(const std::string &executable, const std::vector<std::vector<std::string>> &arguments);
+
+    // Path of the running executable, fallback when it cannot be resolved.
+    std::string CurrentExecutable(const std::string &fallback);
+
+    // Read-only memory mapping of a whole file, shared with the other processes mapping it.
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile();
+
+        bool Open(const std::string &filename);
+        void Close();
+
+        const unsigned char *Data() const { return data_; }
+        size_t Size() const { return size_; }
+
+    private:
+        unsigned char *data_ = nullptr;
+        size_t size_ = 0;
+    };
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <time.h>
 #include <stdio.h>
@@ -16,12 +17,57 @@
 #include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
 
+#include "calibration/image_manifest.h"
+
 #define WIDTH 5000
 #define HEIGHT 4000
 #define VALID_HEIGHT 3800
 
 namespace fishcat
 {
+    // Equirectangular expansion of a fisheye image, angles in degree.
+    struct ExpansionSettings
+    {
+        ExpansionSettings();
+        cv::Rect OutputRegion() const; // the roi clipped to the output, or the full output.
+
+        cv::Size output_size;                // Size of the full panorama
+        double yaw, pitch, roll;             // Rotation of the panorama frame in the camera frame
+        double longitude_min, longitude_max; // Longitude range over the output width
+        double latitude_min, latitude_max;   // Latitude range over the output height, top to bottom
+        cv::Rect roi;                        // Rendered region of the panorama, empty for all
+        std::string output_format;           // BGR, GRAY, I420 or NV12, written by the fused remap kernel
+        int downscale;                       // Integer downscale of the rendered region
+        int tile_size;                       // Output tile of the locality-ordered remap, 0 for a row-major walk
+        bool antialias;                      // Mip-mapped gather of the minified regions
+        int workers;                         // Worker processes over the segments of a video input
+    };
+
+    // Epipolar-rectified equirectangular stereo matching, angles in degree.
+    struct StereoSettings
+    {
+        StereoSettings();
+
+        cv::Size output_size;   // Size of the rectified pair
+        double horizontal_fov;  // Angle range along the baseline over the output width
+        double vertical_fov;    // Angle range around the baseline over the output height
+        int num_disparities;    // Disparity search range in pixels, a multiple of 16
+        int block_size;         // Matched block size, odd
+        int strips;             // Row strips matched in parallel, 0 for one per thread
+        double depth_scale;     // Depth unit of the written 16-bit depth, per translation unit
+    };
+
+    // Rig rotation from natural features, angles in degree.
+    struct TargetlessSettings
+    {
+        TargetlessSettings();
+
+        int max_features;       // ORB features per image
+        double match_ratio;     // Ratio test of the two nearest descriptors
+        double inlier_angle;    // Angular inlier threshold of the RANSAC and the loss scale of the refinement
+        int ransac_iterations;  // Upper bound of the RANSAC hypotheses
+        double baseline;        // Nominal right center along the left x axis, used without a translation in the camera file
+    };
 
     class CalibrationSettings
     {
@@ -34,21 +80,32 @@ namespace fishcat
             CHESSBOARD,
             CIRCLES_GRID,
             ASYMMETRIC_CIRCLES_GRID,
+            CHARUCO,
             META_BOARD
         };
 
         enum CalibrationInputType
         {
             INVALID,
-            IMAGE_LIST
+            IMAGE_LIST,
+            VIDEO_FILE
         };
 
         void Write(cv::FileStorage &fs) const;
         void Read(const cv::FileNode &node);
         void Interprate();
         cv::Mat NextImage();
+        // Decode the next image straight to gray, JPEGs reduced at DCT level by decode_scale (1, 2, 4 or 8).
+        cv::Mat NextGrayImage(int decode_scale);
+        // Full resolution gray of the last image, decoded on demand after a reduced NextGrayImage.
+        // Empty if there is no last image or it cannot be decoded.
+        cv::Mat CurrentGrayImage();
+        bool HasNextImage() const;
+        int ImageCount() const;
+        // Continue the input at the given frame or image, a video is decoded from the keyframe before it
+        // up to the frame. False if the frame cannot be reached.
+        bool SeekFrame(int frame);
         std::vector<cv::Mat> NextImage(bool is_stereo);
-        bool ReadStringList(const std::string &filename, std::vector<std::string> &l);
 
     public:
         cv::Size board_size_;                    // The cv::Size of the board -> Number of items by width and height
@@ -62,7 +119,9 @@ namespace fishcat
         bool flip_vertical_;                     // Flip the captured images around the horizontal axis
         std::string output_fileName_;            // The name of the file where to write
         bool show_undistorsed_;                  // Show undistorted images after calibration
-        bool show_partial_board_;
+        bool show_partial_board_;                // Accept partially visible boards (ChArUco only)
+        float marker_size_;                      // The ArUco marker side of a ChArUco board, in the square unit
+        int charuco_dictionary_;                 // The predefined ArUco dictionary id of a ChArUco board
         std::string input_; // The input ->
         std::string input_path_;
         std::string image_path_;
@@ -70,13 +129,34 @@ namespace fishcat
         int calibration_type_;              // 0 for intrinsic and 1 for extrinsic.
         std::string camera_intrinsic_path_; // yaml file for intrinsic path.
         std::string original_fisheye_image_;
+        std::string camera_model_name_;     // Projection model of the camera file, see camera_models.h.
+        std::string camera_registry_;       // Binary camera registry, replaces the camera file if given.
+        std::string camera_registry_id_;    // Camera of the registry.
+        int camera_registry_version_;       // Version of the registry camera, negative for the latest.
+        ExpansionSettings expansion_;
+        StereoSettings stereo_;
+        TargetlessSettings targetless_;
+
+        bool btrack_corners_;               // Track the corners between consecutive video frames.
+        int decode_scale_;                  // Detect on images decoded at 1/decode_scale, refine at full size.
+        bool bsaddle_refiner_;              // Refine the chessboard corners by their saddle point, not cornerSubPix.
+
+        bool bview_selection_;              // Select a compact subset of views before calibration.
+        int view_selection_max_views_;      // Upper bound of the selected views.
+        double view_selection_time_budget_; // Seconds for the selected-set calibration, 0 for no limit.
+        bool bview_selection_refine_;       // Refine with a full-set pass from the selected-set result.
+
+        bool bcalibrate_vignetting_;        // Fit the radial falloff from the chessboard squares (fisheye only).
 
         bool bis_stereo_camera_; // If use stereo camera
 
         int camera_id_;
-        std::vector<std::string> image_list_;
-        std::vector<std::string> origin_image_list_;
+        std::shared_ptr<ImageManifest> image_manifest_; // Entries of an image input, streamed.
         int at_image_list_;
+        std::string current_image_name_; // Name of the image returned by the last NextImage.
+        std::string current_image_path_;
+        cv::Mat current_gray_image_;
+        bool input_finished_;
         cv::VideoCapture input_capture_;
         CalibrationInputType input_type_;
         bool good_input_;
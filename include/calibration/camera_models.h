@@ -0,0 +1,391 @@
+#ifndef CAMERA_MODELS_H_
+#define CAMERA_MODELS_H_
+
+#include <algorithm>
+#include <cmath>
+
+#include "calibration/kb_inverse_model.h"
+
+namespace fishcat
+{
+    enum CameraModelType
+    {
+        UNKNOWN_MODEL,
+        PINHOLE,
+        KANNALA_BRANDT,
+        UNIFIED,
+        DOUBLE_SPHERE,
+        FOV
+    };
+
+    CameraModelType ParseCameraModelType(const std::string &name);
+    const char *CameraModelName(CameraModelType type);
+
+    // Static interface of the camera models. The kernels are templated on the model,
+    // so Project and Unproject are inlined into their loops without any dispatch.
+    // Project maps a ray of the camera frame to a pixel, Unproject a pixel to a unit ray;
+    // both return false outside of the valid domain of the model.
+    template <class Derived>
+    class CameraModel
+    {
+    public:
+        bool Project(const double *ray, double *pixel) const
+        {
+            return static_cast<const Derived *>(this)->ProjectImpl(ray, pixel);
+        }
+
+        bool Unproject(const double *pixel, double *ray) const
+        {
+            return static_cast<const Derived *>(this)->UnprojectImpl(pixel, ray);
+        }
+
+    protected:
+        void ReadIntrinsic(const cv::Mat &intrinsic)
+        {
+            fx_ = intrinsic.at<double>(0, 0);
+            fy_ = intrinsic.at<double>(1, 1);
+            cx_ = intrinsic.at<double>(0, 2);
+            cy_ = intrinsic.at<double>(1, 2);
+        }
+
+        static void Normalize(double *ray)
+        {
+            double norm = std::sqrt(ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2]);
+            ray[0] /= norm;
+            ray[1] /= norm;
+            ray[2] /= norm;
+        }
+
+        double fx_, fy_, cx_, cy_;
+    };
+
+    // Pinhole model with the OpenCV distortion [k1, k2, p1, p2[, k3[, k4, k5, k6[, s1, s2, s3, s4]]]],
+    // no coefficients for an ideal pinhole. The tilted sensor terms are not supported.
+    class PinholeModel : public CameraModel<PinholeModel>
+    {
+    public:
+        explicit PinholeModel(const cv::Mat &intrinsic, const cv::Mat &coefficients = cv::Mat())
+        {
+            ReadIntrinsic(intrinsic);
+            std::fill(k_, k_ + 12, 0.0);
+            distorted_ = false;
+            for (int i = 0; i < (int)std::min<size_t>(coefficients.total(), 12); i++)
+            {
+                k_[i] = coefficients.at<double>(i);
+                distorted_ = distorted_ || k_[i] != 0;
+            }
+        }
+
+        // the coefficient counts of cv::calibrateCamera, with zero tilt for 14 coefficients.
+        static bool SupportsCoefficients(const cv::Mat &coefficients)
+        {
+            const size_t count = coefficients.total();
+            if (count == 14)
+                return coefficients.at<double>(12) == 0 && coefficients.at<double>(13) == 0;
+            return count == 0 || count == 4 || count == 5 || count == 8 || count == 12;
+        }
+
+        bool ProjectImpl(const double *ray, double *pixel) const
+        {
+            if (ray[2] <= 0)
+                return false;
+            double x = ray[0] / ray[2], y = ray[1] / ray[2];
+            if (distorted_ && !Distort(x, y, x, y))
+                return false;
+            pixel[0] = fx_ * x + cx_;
+            pixel[1] = fy_ * y + cy_;
+            return true;
+        }
+
+        bool UnprojectImpl(const double *pixel, double *ray) const
+        {
+            const double x_d = (pixel[0] - cx_) / fx_, y_d = (pixel[1] - cy_) / fy_;
+            double x = x_d, y = y_d;
+            if (distorted_)
+            {
+                // fixed point iteration as cv::undistortPoints, checked by distorting the result back.
+                for (int iteration = 0; iteration < 20; iteration++)
+                {
+                    double r2 = x * x + y * y;
+                    double inverse_radial = (1 + r2 * (k_[5] + r2 * (k_[6] + r2 * k_[7]))) /
+                                            (1 + r2 * (k_[0] + r2 * (k_[1] + r2 * k_[4])));
+                    if (inverse_radial <= 0)
+                        return false;
+                    double delta_x = 2 * k_[2] * x * y + k_[3] * (r2 + 2 * x * x) + r2 * (k_[8] + r2 * k_[9]);
+                    double delta_y = k_[2] * (r2 + 2 * y * y) + 2 * k_[3] * x * y + r2 * (k_[10] + r2 * k_[11]);
+                    x = (x_d - delta_x) * inverse_radial;
+                    y = (y_d - delta_y) * inverse_radial;
+                }
+                double x_check, y_check;
+                if (!Distort(x, y, x_check, y_check) ||
+                    (x_check - x_d) * (x_check - x_d) + (y_check - y_d) * (y_check - y_d) > 1e-10)
+                    return false;
+            }
+            ray[0] = x;
+            ray[1] = y;
+            ray[2] = 1;
+            Normalize(ray);
+            return true;
+        }
+
+    private:
+        // false where the radial factor folds over.
+        bool Distort(double x, double y, double &x_d, double &y_d) const
+        {
+            double r2 = x * x + y * y;
+            double radial = (1 + r2 * (k_[0] + r2 * (k_[1] + r2 * k_[4]))) / (1 + r2 * (k_[5] + r2 * (k_[6] + r2 * k_[7])));
+            x_d = x * radial + 2 * k_[2] * x * y + k_[3] * (r2 + 2 * x * x) + r2 * (k_[8] + r2 * k_[9]);
+            y_d = y * radial + k_[2] * (r2 + 2 * y * y) + 2 * k_[3] * x * y + r2 * (k_[10] + r2 * k_[11]);
+            return radial > 0;
+        }
+
+        double k_[12];
+        bool distorted_;
+    };
+
+    // Kannala-Brandt (equidistant) model with the coefficients k1..k4, unprojected by the inverse polynomial.
+    class KannalaBrandtModel : public CameraModel<KannalaBrandtModel>
+    {
+    public:
+        KannalaBrandtModel(const cv::Mat &intrinsic, const cv::Mat &coefficients, const KBInverseModel &inverse_model)
+            : inverse_model_(inverse_model)
+        {
+            ReadIntrinsic(intrinsic);
+            for (int i = 0; i < 4; i++)
+                k_[i] = coefficients.at<double>(i);
+        }
+
+        bool ProjectImpl(const double *ray, double *pixel) const
+        {
+            double r = std::sqrt(ray[0] * ray[0] + ray[1] * ray[1]);
+            double theta = std::atan2(r, ray[2]);
+            double theta2 = theta * theta;
+            double r_d = theta * (1 + theta2 * (k_[0] + theta2 * (k_[1] + theta2 * (k_[2] + theta2 * k_[3]))));
+            double scale = r > 1e-12 ? r_d / r : 1.0;
+            pixel[0] = fx_ * ray[0] * scale + cx_;
+            pixel[1] = fy_ * ray[1] * scale + cy_;
+            return theta <= inverse_model_.max_theta;
+        }
+
+        bool UnprojectImpl(const double *pixel, double *ray) const
+        {
+            double x_d = (pixel[0] - cx_) / fx_, y_d = (pixel[1] - cy_) / fy_;
+            double r_d = std::sqrt(x_d * x_d + y_d * y_d);
+            double theta = inverse_model_.Theta(r_d);
+            double scale = r_d > 1e-12 ? std::sin(theta) / r_d : 1.0;
+            ray[0] = x_d * scale;
+            ray[1] = y_d * scale;
+            ray[2] = std::cos(theta);
+            return r_d <= inverse_model_.max_radius;
+        }
+
+    private:
+        double k_[4];
+        KBInverseModel inverse_model_;
+    };
+
+    // Unified camera model in the alpha formulation, coefficients [alpha].
+    class UnifiedCameraModel : public CameraModel<UnifiedCameraModel>
+    {
+    public:
+        UnifiedCameraModel(const cv::Mat &intrinsic, const cv::Mat &coefficients)
+        {
+            ReadIntrinsic(intrinsic);
+            alpha_ = coefficients.at<double>(0);
+        }
+
+        bool ProjectImpl(const double *ray, double *pixel) const
+        {
+            double d = std::sqrt(ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2]);
+            double denominator = alpha_ * d + (1 - alpha_) * ray[2];
+            double w = alpha_ > 0.5 ? (1 - alpha_) / alpha_ : alpha_ / (1 - alpha_);
+            if (denominator <= 0)
+                return false;
+            pixel[0] = fx_ * ray[0] / denominator + cx_;
+            pixel[1] = fy_ * ray[1] / denominator + cy_;
+            return ray[2] > -w * d;
+        }
+
+        bool UnprojectImpl(const double *pixel, double *ray) const
+        {
+            double mx = (pixel[0] - cx_) / fx_ * (1 - alpha_), my = (pixel[1] - cy_) / fy_ * (1 - alpha_);
+            double r2 = mx * mx + my * my;
+            double xi = alpha_ / (1 - alpha_);
+            double discriminant = 1 + (1 - xi * xi) * r2;
+            if (discriminant < 0)
+                return false;
+            double factor = (xi + std::sqrt(discriminant)) / (1 + r2);
+            ray[0] = factor * mx;
+            ray[1] = factor * my;
+            ray[2] = factor - xi;
+            Normalize(ray);
+            return true;
+        }
+
+    private:
+        double alpha_;
+    };
+
+    // Double sphere model, coefficients [xi, alpha]; both directions are closed form.
+    class DoubleSphereModel : public CameraModel<DoubleSphereModel>
+    {
+    public:
+        DoubleSphereModel(const cv::Mat &intrinsic, const cv::Mat &coefficients)
+        {
+            ReadIntrinsic(intrinsic);
+            xi_ = coefficients.at<double>(0);
+            alpha_ = coefficients.at<double>(1);
+        }
+
+        bool ProjectImpl(const double *ray, double *pixel) const
+        {
+            double d1 = std::sqrt(ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2]);
+            double z_shifted = xi_ * d1 + ray[2];
+            double d2 = std::sqrt(ray[0] * ray[0] + ray[1] * ray[1] + z_shifted * z_shifted);
+            double denominator = alpha_ * d2 + (1 - alpha_) * z_shifted;
+            if (denominator <= 0)
+                return false;
+            pixel[0] = fx_ * ray[0] / denominator + cx_;
+            pixel[1] = fy_ * ray[1] / denominator + cy_;
+
+            double w1 = alpha_ <= 0.5 ? alpha_ / (1 - alpha_) : (1 - alpha_) / alpha_;
+            double w2 = (w1 + xi_) / std::sqrt(2 * w1 * xi_ + xi_ * xi_ + 1);
+            return ray[2] > -w2 * d1;
+        }
+
+        bool UnprojectImpl(const double *pixel, double *ray) const
+        {
+            double mx = (pixel[0] - cx_) / fx_, my = (pixel[1] - cy_) / fy_;
+            double r2 = mx * mx + my * my;
+            if (alpha_ > 0.5 && r2 > 1 / (2 * alpha_ - 1))
+                return false;
+            double mz = (1 - alpha_ * alpha_ * r2) / (alpha_ * std::sqrt(1 - (2 * alpha_ - 1) * r2) + 1 - alpha_);
+            double factor = (mz * xi_ + std::sqrt(mz * mz + (1 - xi_ * xi_) * r2)) / (mz * mz + r2);
+            ray[0] = factor * mx;
+            ray[1] = factor * my;
+            ray[2] = factor * mz - xi_;
+            Normalize(ray);
+            return true;
+        }
+
+    private:
+        double xi_, alpha_;
+    };
+
+    // Field-of-view model of Devernay and Faugeras, coefficients [w].
+    class FOVModel : public CameraModel<FOVModel>
+    {
+    public:
+        FOVModel(const cv::Mat &intrinsic, const cv::Mat &coefficients)
+        {
+            ReadIntrinsic(intrinsic);
+            w_ = coefficients.at<double>(0);
+            two_tan_half_w_ = 2 * std::tan(w_ / 2);
+        }
+
+        // the model covers the rays in front of the camera, and is the pinhole in the limit w = 0.
+        bool ProjectImpl(const double *ray, double *pixel) const
+        {
+            if (ray[2] <= 0)
+                return false;
+            double scale = 1 / ray[2];
+            if (w_ > kMinW)
+            {
+                double r = std::sqrt(ray[0] * ray[0] + ray[1] * ray[1]);
+                scale = r > 1e-12 ? std::atan2(r * two_tan_half_w_, ray[2]) / (w_ * r) : scale * two_tan_half_w_ / w_;
+            }
+            pixel[0] = fx_ * ray[0] * scale + cx_;
+            pixel[1] = fy_ * ray[1] * scale + cy_;
+            return true;
+        }
+
+        bool UnprojectImpl(const double *pixel, double *ray) const
+        {
+            double mx = (pixel[0] - cx_) / fx_, my = (pixel[1] - cy_) / fy_;
+            if (w_ <= kMinW)
+            {
+                ray[0] = mx;
+                ray[1] = my;
+                ray[2] = 1;
+                Normalize(ray);
+                return true;
+            }
+            double r_d = std::sqrt(mx * mx + my * my);
+            double angle = r_d * w_;
+            if (angle >= CV_PI / 2)
+                return false;
+            double scale = r_d > 1e-12 ? std::sin(angle) / r_d : w_;
+            ray[0] = mx * scale;
+            ray[1] = my * scale;
+            ray[2] = two_tan_half_w_ * std::cos(angle);
+            Normalize(ray);
+            return true;
+        }
+
+    private:
+        static constexpr double kMinW = 1e-8;
+        double w_, two_tan_half_w_;
+    };
+
+    // Builds the model of model_type once and runs the kernel on it, so the kernel is instantiated per model.
+    // inverse_model is only used by the Kannala-Brandt model. Returns false for an unknown model or
+    // pinhole coefficients the model does not support.
+    template <class Kernel>
+    bool DispatchCameraModel(CameraModelType model_type, const cv::Mat &intrinsic, const cv::Mat &coefficients,
+                             const KBInverseModel &inverse_model, Kernel &&kernel)
+    {
+        switch (model_type)
+        {
+        case PINHOLE:
+            if (!PinholeModel::SupportsCoefficients(coefficients))
+                return false;
+            kernel(PinholeModel(intrinsic, coefficients));
+            return true;
+        case KANNALA_BRANDT:
+            kernel(KannalaBrandtModel(intrinsic, coefficients, inverse_model));
+            return true;
+        case UNIFIED:
+            kernel(UnifiedCameraModel(intrinsic, coefficients));
+            return true;
+        case DOUBLE_SPHERE:
+            kernel(DoubleSphereModel(intrinsic, coefficients));
+            return true;
+        case FOV:
+            kernel(FOVModel(intrinsic, coefficients));
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Reprojection kernel over count points of one view, the squared pixel errors are written to errors.
+    template <class Model>
+    double ReprojectionErrors(const Model &model, const cv::Point3f *object_points, const cv::Point2f *image_points,
+                              int count, const cv::Mat &rvec, const cv::Mat &tvec, std::vector<double> &errors)
+    {
+        cv::Mat rotation;
+        cv::Rodrigues(rvec, rotation);
+        rotation.convertTo(rotation, CV_64F);
+        cv::Mat translation;
+        tvec.convertTo(translation, CV_64F);
+        const double *R = rotation.ptr<double>(), *t = translation.ptr<double>();
+
+        double total_error = 0;
+        errors.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            const cv::Point3f &X = object_points[i];
+            double ray[3] = {R[0] * X.x + R[1] * X.y + R[2] * X.z + t[0],
+                             R[3] * X.x + R[4] * X.y + R[5] * X.z + t[1],
+                             R[6] * X.x + R[7] * X.y + R[8] * X.z + t[2]};
+            double pixel[2];
+            model.Project(ray, pixel);
+            double dx = pixel[0] - image_points[i].x, dy = pixel[1] - image_points[i].y;
+            errors[i] = dx * dx + dy * dy;
+            total_error += errors[i];
+        }
+        return total_error;
+    }
+}
+
+#endif
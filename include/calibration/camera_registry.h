@@ -0,0 +1,73 @@
+#ifndef CAMERA_REGISTRY_H_
+#define CAMERA_REGISTRY_H_
+
+#include <cstdint>
+
+#include "base/worker_process.h"
+#include "calibration/calibration_base.h"
+#include "calibration/camera_models.h"
+#include "calibration/vignetting.h"
+
+namespace fishcat
+{
+    // One calibrated camera, with all an application needs to project and unproject through it.
+    struct CameraRecord
+    {
+        CameraRecord() : version(1), model_type(KANNALA_BRANDT), remap_key(0) {}
+
+        std::string id;
+        int version;                  // calibration version of the id, the latest one is found by default.
+        CameraModelType model_type;   // lens type.
+        cv::Size image_size;          // calibrated image size, empty if unknown.
+        cv::Mat intrinsic;            // 3x3 CV_64F.
+        cv::Mat coefficients;         // CV_64F column.
+        KBInverseModel inverse_model; // empty coefficients if not fitted.
+        VignettingModel vignetting;   // empty coefficients for no vignetting.
+        std::string remap_tables;     // remap table file precomputed for this camera, may be empty.
+        uint64_t remap_key;           // hash of the settings the remap tables were built with.
+    };
+
+    // FNV-1a of raw bytes, the hash of the registry index and of the remap keys.
+    uint64_t CameraRegistryHash(const void *data, size_t size);
+    uint64_t CameraRegistryHash(const std::string &text);
+
+    // A camera file: the calibration output (Camera_Matrix, Distortion_Coefficients) or the camera layout of
+    // the applications (in1_intrinsic, in1_coff), with the optional inverse and vignetting models. The id is
+    // Camera_Id or the file name, the model is Camera_Model or default_model.
+    bool ReadCameraFile(const std::string &filename, CameraRecord &camera, CameraModelType default_model = KANNALA_BRANDT);
+    // A camera list of the registry export (Cameras: a sequence of cameras), or a single camera file.
+    bool ReadCameraList(const std::string &filename, std::vector<CameraRecord> &cameras);
+    bool WriteCameraList(const std::string &filename, const std::vector<CameraRecord> &cameras);
+
+    // Indexed binary file of many cameras. The records have a fixed size and the index is an open
+    // addressing hash of the ids, so a camera is found in constant time from the mapping without
+    // reading any other record. Every (id, version) pair is unique.
+    bool WriteCameraRegistry(const std::string &filename, const std::vector<CameraRecord> &cameras);
+
+    class CameraRegistry
+    {
+    public:
+        // Maps the file and checks the index and the record links against its size, no camera is parsed.
+        bool Open(const std::string &filename);
+
+        int Count() const { return count_; }
+        // The latest version of the id for a negative version.
+        bool Find(const std::string &id, CameraRecord &camera, int version = -1) const;
+        bool Record(int index, CameraRecord &camera) const;
+
+    private:
+        int FindIndex(const std::string &id) const;
+
+        MappedFile file_;
+        int count_ = 0;
+        int buckets_ = 0;
+        const int32_t *index_ = nullptr;
+        const unsigned char *records_ = nullptr;
+    };
+
+    // The camera of the settings, from the registry if Camera_Registry is given, else from Camera_Intrinsic_Path
+    // with its own Camera_Model, or the Camera_Model of the settings if the file has none.
+    bool ReadSettingsCamera(const CalibrationSettings &s, CameraRecord &camera);
+}
+
+#endif
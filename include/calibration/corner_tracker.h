@@ -0,0 +1,46 @@
+#ifndef CORNER_TRACKER_H_
+#define CORNER_TRACKER_H_
+
+#include "calibration/pattern_detector.h"
+
+namespace fishcat
+{
+    // Follows the board through a video with pyramidal LK flow and falls back to
+    // the full detection of the pattern detector when the tracking is lost.
+    class CornerTracker
+    {
+    public:
+        explicit CornerTracker(PatternDetector &detector);
+
+        // Same contract as PatternDetector::Detect, for consecutive frames of a stream.
+        bool Process(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                     std::vector<float> *confidences = nullptr);
+        void Reset();
+        // True if the board moved enough since the last keyframe to be a new calibration view, which then
+        // becomes the last keyframe. Consecutive frames are near duplicates and only slow the solver down.
+        bool IsKeyframe(const std::vector<cv::Point2f> &points, const std::vector<int> &point_ids,
+                        const cv::Size &image_size);
+
+        int tracked_frames_;
+        int detected_frames_;
+        int keyframes_;
+
+    private:
+        bool Track(const std::vector<cv::Mat> &pyramid, const cv::Mat &gray,
+                   std::vector<cv::Point2f> &points, std::vector<int> &point_ids, std::vector<float> *confidences);
+        // Drop the points which disagree with the local board homography of their neighbors.
+        int RejectLocalOutliers(std::vector<cv::Point2f> &points, std::vector<int> &point_ids) const;
+
+        PatternDetector &detector_;
+        double board_spacing_;                          // closest distance between two board points.
+        std::vector<std::vector<int>> board_neighbors_; // board ids around every board point.
+        std::vector<cv::Point2f> keyframe_points_;      // by board id, negative for the points not seen.
+
+        std::vector<cv::Mat> previous_pyramid_;
+        std::vector<cv::Point2f> previous_points_;
+        std::vector<int> previous_ids_;
+        int frames_since_detection_;
+    };
+}
+
+#endif
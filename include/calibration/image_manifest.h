@@ -0,0 +1,60 @@
+#ifndef IMAGE_MANIFEST_H_
+#define IMAGE_MANIFEST_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace fishcat
+{
+    // Image entries of an input, read one at a time so the decoding starts before the list is known.
+    // The source is one of
+    //   - an OpenCV list (.xml, .yml, .yaml, .json), a sequence of names as before,
+    //   - a line-based list (.txt, .lst), one name per line, empty lines and '#' comments skipped,
+    //   - a directory, or a glob of names in a directory ("frames/*.jpg"), in name order.
+    // The names of the lists are relative to the base path, the ones of a directory to it.
+    class ImageManifest
+    {
+    public:
+        // The source names a manifest rather than a video.
+        static bool IsManifest(const std::string &source);
+
+        bool Open(const std::string &source, const std::string &base_path);
+        bool HasNext() const;
+        // The name of the next entry and the path to read it from.
+        bool Next(std::string &name, std::string &path);
+        // Continue at the given entry, a line-based list is read again from its start.
+        bool Seek(int index);
+        // Number of entries, a line-based list is scanned once for it.
+        int Count() const;
+        int Position() const { return position_; }
+
+    private:
+        enum SourceKind
+        {
+            NO_SOURCE,
+            STORAGE_LIST,
+            TEXT_LIST,
+            DIRECTORY
+        };
+
+        bool ReadTextEntry();
+
+        SourceKind kind_ = NO_SOURCE;
+        std::string source_;
+        std::string base_path_;
+        int position_ = 0;
+        mutable int count_ = -1;
+
+        cv::FileStorage storage_;
+        cv::FileNode storage_list_;
+        std::ifstream text_;
+        std::string pending_entry_; // the next entry of a line-based list, read ahead.
+        bool has_pending_entry_ = false;
+        std::vector<std::string> directory_entries_;
+    };
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define INTRINSIC_CALIBRATION_H_
 
 #include "calibration/calibration_base.h"
+#include "calibration/observation_store.h"
+#include "calibration/vignetting.h"
 
 namespace fishcat
 {
@@ -9,16 +11,17 @@ namespace fishcat
 
     void SaveIntrinsicCameraParams(CalibrationSettings &s, cv::Size &image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs,
                                    const std::vector<cv::Mat> &rvecs, const std::vector<cv::Mat> &tvecs,
-                                   const std::vector<float> &reproj_errs, const std::vector<std::vector<cv::Point2f>> &image_points,
-                                   double total_avg_err);
-    bool RunCalibrationAndSave(CalibrationSettings &s, cv::Size image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs, std::vector<std::vector<cv::Point2f>> image_points, std::vector<std::vector<cv::Point3f>> object_points);
+                                   const std::vector<float> &reproj_errs, const ObservationStore &observations,
+                                   double total_avg_err, const VignettingModel &vignetting = VignettingModel());
+    // vignetting_samples are collected from the calibration images when the vignetting is calibrated.
+    bool RunCalibrationAndSave(CalibrationSettings &s, cv::Size image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs,
+                               const ObservationStore &observations,
+                               const std::vector<VignettingSample> &vignetting_samples = std::vector<VignettingSample>());
     bool RunCalibration(CalibrationSettings &s, cv::Size &image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs,
-                        std::vector<std::vector<cv::Point2f>> image_points,
-                        std::vector<std::vector<cv::Point3f>> object_points,
+                        const ObservationStore &observations,
                         std::vector<cv::Mat> &rvecs, std::vector<cv::Mat> &tvecs,
                         std::vector<float> &reproj_errs, double &avg_err);
-    double ComputeReprojectionErrors(const std::vector<std::vector<cv::Point3f>> &object_points,
-                                     const std::vector<std::vector<cv::Point2f>> &image_points,
+    double ComputeReprojectionErrors(const ObservationStore &observations,
                                      const std::vector<cv::Mat> &rvecs, const std::vector<cv::Mat> &tvecs,
                                      const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs,
                                      std::vector<float> &perViewErrors,
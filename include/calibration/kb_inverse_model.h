@@ -0,0 +1,46 @@
+#ifndef KB_INVERSE_MODEL_H_
+#define KB_INVERSE_MODEL_H_
+
+#include "calibration/calibration_base.h"
+
+namespace fishcat
+{
+    // Fixed-cost inverse of the Kannala-Brandt distortion r_d = theta (1 + k1 theta^2 + ... + k4 theta^8),
+    // an odd polynomial theta = sum_i a_i s^(2i + 1) of the normalized radius s = r_d / max_radius.
+    struct KBInverseModel
+    {
+        std::vector<double> coefficients; // a_0 .. a_n
+        double max_theta;                 // upper bound of the fitted theta range.
+        double max_radius;                // r_d at max_theta.
+        double max_error;                 // maximum angular error over [0, max_theta], in radian.
+
+        double Theta(double r_d) const
+        {
+            double s = std::min(r_d, max_radius) / max_radius;
+            double s2 = s * s, theta = 0;
+            for (int i = (int)coefficients.size() - 1; i >= 0; i--)
+                theta = theta * s2 + coefficients[i];
+            return theta * s;
+        }
+    };
+
+    // Forward KB distortion of theta, the coefficients may be a row or a column vector.
+    double KBDistortTheta(double theta, const cv::Mat &distortion_coefficient);
+
+    // The fit stops at the smallest degree within max_error_tolerance, or at the largest degree.
+    KBInverseModel FitKBInverseModel(const cv::Mat &distortion_coefficient, double max_theta,
+                                     double max_error_tolerance = 1e-5);
+    // theta range taken from the normalized radius of the farthest image corner.
+    KBInverseModel FitKBInverseModel(const cv::Mat &intrinsic, const cv::Mat &distortion_coefficient,
+                                     const cv::Size &image_size, double max_error_tolerance = 1e-5);
+
+    // Maximum angular error (radian) of the inverse model against the forward model over its FOV.
+    double ValidateKBInverseModel(const KBInverseModel &inverse_model, const cv::Mat &distortion_coefficient);
+
+    void WriteKBInverseModel(cv::FileStorage &fs, const KBInverseModel &inverse_model);
+    bool ReadKBInverseModel(const cv::FileStorage &fs, KBInverseModel &inverse_model);
+    // from a map inside a file, e.g. one camera of a camera list.
+    bool ReadKBInverseModel(const cv::FileNode &node, KBInverseModel &inverse_model);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef OBSERVATION_STORE_H_
+#define OBSERVATION_STORE_H_
+
+#include "calibration/calibration_base.h"
+
+namespace fishcat
+{
+    // Board observations of all the views in one contiguous corner array with per-view offsets.
+    // The board geometry is stored once, every corner keeps the id of its board point, so views
+    // with only some of the corners are supported.
+    class ObservationStore
+    {
+    public:
+        explicit ObservationStore(const std::vector<cv::Point3f> &board_points = std::vector<cv::Point3f>());
+
+        // Capacity for views views holding points corners in total.
+        void Reserve(int views, int points);
+        void AddView(const std::vector<cv::Point2f> &points, const std::vector<int> &point_ids);
+        // The given views, in the given order.
+        ObservationStore Subset(const std::vector<int> &views) const;
+
+        int ViewCount() const { return (int)view_offsets_.size() - 1; }
+        int PointCount() const { return (int)points_.size(); }
+        int ViewSize(int view) const { return view_offsets_[view + 1] - view_offsets_[view]; }
+        // The view holds all the board points, in id order.
+        bool IsComplete(int view) const { return object_offsets_[view] < 0; }
+        bool AllComplete() const { return (int)partial_object_points_.size() == 0; }
+
+        const cv::Point2f *ViewPoints(int view) const { return points_.data() + view_offsets_[view]; }
+        const int *ViewIds(int view) const { return point_ids_.data() + view_offsets_[view]; }
+        const cv::Point3f *ViewObjectPoints(int view) const
+        {
+            return IsComplete(view) ? board_points_.data() : partial_object_points_.data() + object_offsets_[view];
+        }
+        const std::vector<cv::Point3f> &BoardPoints() const { return board_points_; }
+
+        // Mat headers over the store for the OpenCV solvers, no point is copied. The complete views
+        // all share the board array. The headers are valid until the store is modified.
+        void ImagePointArrays(std::vector<cv::Mat> &arrays) const;
+        void ObjectPointArrays(std::vector<cv::Mat> &arrays) const;
+
+    private:
+        void AppendView(const cv::Point2f *points, const int *point_ids, int count);
+
+        std::vector<cv::Point3f> board_points_;
+        std::vector<cv::Point2f> points_;
+        std::vector<int> point_ids_;
+        std::vector<int> view_offsets_;                  // ViewCount() + 1 entries into points_.
+        std::vector<int> object_offsets_;                // into partial_object_points_, -1 for the complete views.
+        std::vector<cv::Point3f> partial_object_points_; // gathered board points of the partial views.
+    };
+}
+
+#endif
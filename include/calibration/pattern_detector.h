@@ -0,0 +1,86 @@
+#ifndef PATTERN_DETECTOR_H_
+#define PATTERN_DETECTOR_H_
+
+#include <memory>
+
+#include "calibration/calibration_base.h"
+
+namespace fishcat
+{
+    // Detects one calibration pattern on gray images. The detected points come
+    // with ids indexing into the board points, so partial boards are supported.
+    class PatternDetector
+    {
+    public:
+        virtual ~PatternDetector() {}
+
+        // confidences, if given, receives the confidence of every point, empty when the refiner reports none.
+        virtual bool Detect(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                            std::vector<float> *confidences = nullptr) = 0;
+
+        // Refine points predicted close to their true location, e.g. by tracking.
+        virtual void RefinePoints(const cv::Mat &gray, std::vector<cv::Point2f> &points,
+                                  std::vector<float> *confidences = nullptr) const;
+        virtual bool SupportsPartial() const { return false; }
+
+        const std::vector<cv::Point3f> &BoardPoints() const { return board_points_; }
+
+    protected:
+        std::vector<cv::Point3f> board_points_;
+    };
+
+    class ChessboardDetector : public PatternDetector
+    {
+    public:
+        // saddle_refine refines the corners by RefineSaddlePoints instead of cornerSubPix.
+        ChessboardDetector(const cv::Size &board_size, float square_size, bool saddle_refine);
+        bool Detect(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                    std::vector<float> *confidences = nullptr);
+        void RefinePoints(const cv::Mat &gray, std::vector<cv::Point2f> &points,
+                          std::vector<float> *confidences = nullptr) const;
+
+    private:
+        cv::Size board_size_;
+        bool saddle_refine_;
+    };
+
+    // Symmetric and asymmetric circle grids. Large images are detected on a
+    // reduced copy and the centers are refined at the full resolution.
+    class CirclesGridDetector : public PatternDetector
+    {
+    public:
+        CirclesGridDetector(const cv::Size &board_size, float square_size, bool asymmetric);
+        bool Detect(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                    std::vector<float> *confidences = nullptr);
+        void RefinePoints(const cv::Mat &gray, std::vector<cv::Point2f> &points,
+                          std::vector<float> *confidences = nullptr) const;
+
+    private:
+        cv::Size board_size_;
+        bool asymmetric_;
+    };
+
+    // ChArUco board of board_size squares, reports the visible inner corners only.
+    class CharucoDetector : public PatternDetector
+    {
+    public:
+        CharucoDetector(const cv::Size &board_size, float square_size, float marker_size,
+                        int dictionary_id, bool allow_partial, bool saddle_refine);
+        bool Detect(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                    std::vector<float> *confidences = nullptr);
+        bool SupportsPartial() const { return allow_partial_; }
+
+    private:
+        struct Impl;
+        std::shared_ptr<Impl> impl_;
+        cv::Size corner_grid_; // inner corners of the squares.
+        bool allow_partial_;
+        bool saddle_refine_;
+        int min_points_;
+    };
+
+    // nullptr for the patterns not supported by this build.
+    std::unique_ptr<PatternDetector> CreatePatternDetector(const CalibrationSettings &s);
+}
+
+#endif
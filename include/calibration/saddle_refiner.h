@@ -0,0 +1,18 @@
+#ifndef SADDLE_REFINER_H_
+#define SADDLE_REFINER_H_
+
+#include "calibration/calibration_base.h"
+
+namespace fishcat
+{
+    // Refines chessboard corners to the saddle point of a quadratic surface fitted to the smoothed
+    // intensity around them. The window of every corner is sized from the distance to its grid neighbors,
+    // so it stays inside the four squares of the corner at the compressed fisheye periphery as well as at
+    // the center. point_ids index a row-major grid of grid_size inner corners.
+    // confidences gets the balance of the two saddle curvatures in [0, 1], 1 for a symmetric X junction.
+    // Corners without a saddle in their window keep their position and get a confidence of 0.
+    void RefineSaddlePoints(const cv::Mat &gray, const cv::Size &grid_size, const std::vector<int> &point_ids,
+                            std::vector<cv::Point2f> &points, std::vector<float> &confidences);
+}
+
+#endif
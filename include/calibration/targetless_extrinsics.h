@@ -0,0 +1,41 @@
+#ifndef TARGETLESS_EXTRINSICS_H_
+#define TARGETLESS_EXTRINSICS_H_
+
+#include "calibration/calibration_base.h"
+#include "calibration/camera_models.h"
+
+namespace fishcat
+{
+    // A feature seen by both cameras, as unit rays of the left and the right camera frames.
+    struct BearingMatch
+    {
+        cv::Vec3d left, right;
+    };
+
+    // Detects ORB features in both images, keeps the matches passing the ratio test both ways and lifts
+    // them to bearings with the camera models. Appends to matches and returns the number appended.
+    int CollectBearingMatches(const cv::Mat &left, const cv::Mat &right, const KannalaBrandtModel &left_model,
+                              const KannalaBrandtModel &right_model, const TargetlessSettings &settings,
+                              std::vector<BearingMatch> &matches);
+
+    // Rotation with right = rotation * left for the matched bearings. The baseline is neglected
+    // against the depth of the features, which holds for ordinary footage of a compact rig.
+    struct RotationEstimate
+    {
+        cv::Matx33d rotation;
+        std::vector<int> inliers; // indices into the matches.
+        double rms_angle;         // of the inliers, in degree.
+    };
+
+    // RANSAC over the two-bearing minimal solver, the hypotheses of every round are scored in parallel
+    // and the number of rounds adapts to the inlier ratio. Returns false without a consistent rotation.
+    bool EstimateRelativeRotation(const std::vector<BearingMatch> &matches, const TargetlessSettings &settings,
+                                  RotationEstimate &estimate);
+
+    // Refines the rotation on the inliers with Ceres under a Cauchy loss of the inlier angle, then
+    // collects the inliers and their rms angle again.
+    void RefineRelativeRotation(const std::vector<BearingMatch> &matches, const TargetlessSettings &settings,
+                                RotationEstimate &estimate);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef VIEW_SELECTION_H_
+#define VIEW_SELECTION_H_
+
+#include "calibration/calibration_base.h"
+#include "calibration/observation_store.h"
+
+namespace fishcat
+{
+    // Per-view statistics used by the greedy selection.
+    struct ViewDescriptor
+    {
+        std::vector<int> image_cells;  // occupied cells of the image-plane grid.
+        std::vector<int> radial_bins;  // occupied bins of the normalized radius (theta proxy).
+        cv::Vec3d pose;                // [log anisotropy, cos 2phi, sin 2phi] of the board affinity.
+        double log_scale;              // log of the projected board scale.
+    };
+
+    ViewDescriptor DescribeCalibrationView(const cv::Size &image_size, const ObservationStore &observations, int view);
+
+    // Greedily order the views by their gain in image-plane coverage, radial coverage
+    // and pose diversity, and return at most max_views indices in the selection order.
+    std::vector<int> SelectCalibrationViews(const cv::Size &image_size, const ObservationStore &observations,
+                                            int max_views);
+
+    // Time a pilot calibration on the head of the selection and cut the selection
+    // to the number of views which fits into the time budget (in seconds) left after the pilot.
+    void FitViewsToTimeBudget(const CalibrationSettings &s, const cv::Size &image_size,
+                              const ObservationStore &observations,
+                              double time_budget, std::vector<int> &selected_views);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef VIGNETTING_H_
+#define VIGNETTING_H_
+
+#include "calibration/calibration_base.h"
+
+namespace fishcat
+{
+    // Radial falloff V(theta) = 1 + v1 theta^2 + v2 theta^4 + ... of the incidence angle theta,
+    // the observed intensity is V(theta) times the scene radiance.
+    struct VignettingModel
+    {
+        std::vector<double> coefficients; // v1 .. vn, empty for no vignetting.
+        double max_theta;                 // upper bound of the fitted theta range, the gain is held beyond.
+
+        VignettingModel() : max_theta(0) {}
+
+        double Gain(double theta) const
+        {
+            if (coefficients.empty())
+                return 1.0;
+            double theta2 = std::min(theta, max_theta);
+            theta2 *= theta2;
+            double falloff = 0;
+            for (int i = (int)coefficients.size() - 1; i >= 0; i--)
+                falloff = (falloff + coefficients[i]) * theta2;
+            return 1.0 / std::max(1 + falloff, 1e-3);
+        }
+    };
+
+    // Mean intensity around the center of a bright board square.
+    struct VignettingSample
+    {
+        int view;
+        cv::Point2f pixel;
+        float intensity;
+    };
+
+    // Samples the bright squares of a detected chessboard (row-major ids over board_size inner corners),
+    // the square centers are taken from the image corners, so no pose is needed.
+    void CollectVignettingSamples(const cv::Mat &gray, int view, const std::vector<cv::Point2f> &points,
+                                  const std::vector<int> &point_ids, const cv::Size &board_size,
+                                  std::vector<VignettingSample> &samples);
+
+    // Fits V(theta) and one exposure per view, the pixels are converted to theta by the KB model.
+    VignettingModel FitVignettingModel(const std::vector<VignettingSample> &samples, const cv::Mat &intrinsic,
+                                       const cv::Mat &distortion_coefficient, const cv::Size &image_size, int degree = 3);
+
+    void WriteVignettingModel(cv::FileStorage &fs, const VignettingModel &vignetting);
+    bool ReadVignettingModel(const cv::FileStorage &fs, VignettingModel &vignetting);
+    bool ReadVignettingModel(const cv::FileNode &node, VignettingModel &vignetting);
+}
+
+#endif
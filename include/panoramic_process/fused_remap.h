@@ -0,0 +1,71 @@
+#ifndef FUSED_REMAP_H_
+#define FUSED_REMAP_H_
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace fishcat
+{
+    enum RemapOutputFormat
+    {
+        REMAP_UNKNOWN_FORMAT,
+        REMAP_BGR,      // CV_8UC3
+        REMAP_GRAY,     // CV_8UC1, the BT.601 luma
+        REMAP_YUV_I420, // CV_8UC1 of height * 3 / 2 rows, Y plane then the U and V planes
+        REMAP_NV12      // CV_8UC1 of height * 3 / 2 rows, Y plane then the interleaved UV plane
+    };
+
+    RemapOutputFormat ParseRemapOutputFormat(const std::string &name);
+
+    // Output tiles of a remap in the order of their source footprint. A row-major walk of a fisheye
+    // remap gathers along curves across the whole source, the tiles are instead visited along the
+    // Morton curve of their source centers, so consecutive tiles read neighbouring source lines.
+    struct RemapTiling
+    {
+        cv::Size output_size;                // size of the remap tables.
+        std::vector<cv::Rect> tiles;         // output regions, in the execution order.
+        std::vector<cv::Rect> source_bounds; // source pixels read by every tile, empty when it reads none.
+    };
+
+    // Splits the output of the float remap tables into tiles of tile_size (even, so the 4:2:0 formats
+    // can use them) and orders them by the source locality. The tables may be converted afterwards.
+    void BuildRemapTiling(const cv::Mat &map_x, const cv::Mat &map_y, const cv::Size &source_size,
+                          int tile_size, RemapTiling &tiling);
+
+    // cv::remap over the tiles, with any map format accepted by cv::remap. The source footprint of
+    // the next tile is prefetched while the current one is gathered. The tiles are spread over the
+    // OpenCV thread pool, not OpenMP, so the nested cv::remap calls do not oversubscribe the cores.
+    void TiledRemap(const cv::Mat &src, const cv::Mat &map1, const cv::Mat &map2, const RemapTiling &tiling,
+                    cv::Mat &dst, int interpolation = cv::INTER_LINEAR);
+
+    // Downscales float remap tables by an integer factor, so that the resize is folded into the
+    // gather. Every entry is the center of its factor x factor block, invalid if any of them is.
+    void DownscaleRemapTable(const cv::Mat &map_x, const cv::Mat &map_y, int factor,
+                             cv::Mat &scaled_map_x, cv::Mat &scaled_map_y);
+
+    // Gathers the 8-bit gray or BGR source through the float remap tables (bilinear, black outside)
+    // and writes the requested format in the same pass, without any intermediate BGR frame.
+    // A CV_32FC1 gain table of the map size, if given, scales every gathered pixel (vignetting).
+    // The 4:2:0 formats need an even table size. The output is walked in the order of the tiling if
+    // given, by rows otherwise. Returns false on unsupported input.
+    bool FusedRemap(const cv::Mat &src, const cv::Mat &map_x, const cv::Mat &map_y,
+                    RemapOutputFormat format, cv::Mat &dst, const cv::Mat &gain = cv::Mat(),
+                    const RemapTiling *tiling = nullptr);
+
+    // Level of detail of every entry of the float remap tables, log2 of the source footprint of one
+    // output pixel, 0 where the source is magnified or the entry is invalid. It is built once with
+    // the tables, like them it only depends on the camera and the output.
+    void BuildRemapLod(const cv::Mat &map_x, const cv::Mat &map_y, cv::Mat &lod);
+
+    // Source pyramid deep enough for the lod table, level 0 is the source and every level is a
+    // cv::pyrDown of the previous one.
+    void BuildRemapPyramid(const cv::Mat &src, const cv::Mat &lod, std::vector<cv::Mat> &pyramid);
+
+    // Antialiased FusedRemap, every entry is gathered trilinearly from the two pyramid levels
+    // around its lod, so the minified regions do not alias at about twice the bilinear cost.
+    bool FusedRemap(const std::vector<cv::Mat> &pyramid, const cv::Mat &map_x, const cv::Mat &map_y, const cv::Mat &lod,
+                    RemapOutputFormat format, cv::Mat &dst, const cv::Mat &gain = cv::Mat(),
+                    const RemapTiling *tiling = nullptr);
+}
+
+#endif
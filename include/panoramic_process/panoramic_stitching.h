@@ -2,11 +2,26 @@
 #define PANORAMIC_STITCHING_
 
 #include "calibration/calibration_base.h"
+#include "calibration/kb_inverse_model.h"
+#include "panoramic_process/fused_remap.h"
+#include "panoramic_process/remap_kernels.h"
 
 namespace fishcat
 {
     void PanoramicStitchingStereo(cv::Mat right_image, cv::Mat left_image, cv::Mat rotation, cv::Mat translation, double fov);
-    void FisheyeExpansion(cv::Mat fisheye_image, cv::Mat intrinsic, cv::Mat distortion_coefficient);
-    cv::Point2d FisheyeToNormalCylinder(double u, double v, cv::Mat intrinsic, cv::Mat distortion_coefficient);
+
+    // Remap tables of settings.OutputRegion() into the image of the given camera model. The model is
+    // dispatched once here, the per-pixel kernel is specialized on it (see remap_kernels.h).
+    // inverse_model is only used by the Kannala-Brandt model. Returns false for an unknown model.
+    bool BuildExpansionMap(CameraModelType model_type, const cv::Mat &intrinsic, const cv::Mat &coefficients,
+                           const KBInverseModel &inverse_model, const ExpansionSettings &settings,
+                           cv::Mat &map_x, cv::Mat &map_y);
+    // Per-entry vignetting gain of the remap tables, to be applied by the fused remap.
+    bool BuildVignettingGain(CameraModelType model_type, const cv::Mat &intrinsic, const cv::Mat &coefficients,
+                             const KBInverseModel &inverse_model, const VignettingModel &vignetting,
+                             const cv::Mat &map_x, const cv::Mat &map_y, cv::Mat &gain);
+    // Tiled in the source order if a tiling of the maps is given (see fused_remap.h).
+    void FisheyeExpansion(const cv::Mat &fisheye_image, const cv::Mat &map1, const cv::Mat &map2, cv::Mat &expanded_image,
+                          const RemapTiling *tiling = nullptr);
 }
 #endif
\ No newline at end of file
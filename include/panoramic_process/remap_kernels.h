@@ -0,0 +1,175 @@
+#ifndef REMAP_KERNELS_H_
+#define REMAP_KERNELS_H_
+
+#include "calibration/camera_models.h"
+#include "calibration/vignetting.h"
+
+namespace fishcat
+{
+    // Rotation taking the rays of the panorama frame into the camera frame.
+    cv::Mat ExpansionRotation(const ExpansionSettings &settings);
+
+    // Remap tables of settings.OutputRegion() of the equirectangular panorama into the image
+    // of the model. Rays outside of the model domain map outside of the image.
+    template <class Model>
+    void BuildEquirectangularMap(const Model &model, const ExpansionSettings &settings, cv::Mat &map_x, cv::Mat &map_y)
+    {
+        const cv::Mat rotation = ExpansionRotation(settings);
+        const double *R = rotation.ptr<double>();
+
+        const cv::Rect region = settings.OutputRegion();
+        const double longitude_step = (settings.longitude_max - settings.longitude_min) * CV_PI / 180 / settings.output_size.width;
+        const double latitude_step = (settings.latitude_max - settings.latitude_min) * CV_PI / 180 / settings.output_size.height;
+        const double longitude_origin = settings.longitude_min * CV_PI / 180;
+        const double latitude_origin = settings.latitude_min * CV_PI / 180;
+
+        // only the requested region is mapped, the pixels are sampled at their centers.
+        map_x.create(region.size(), CV_32FC1);
+        map_y.create(region.size(), CV_32FC1);
+
+#pragma omp parallel for
+        for (int row = 0; row < region.height; row++)
+        {
+            float *map_x_row = map_x.ptr<float>(row);
+            float *map_y_row = map_y.ptr<float>(row);
+            const double latitude = latitude_origin + (region.y + row + 0.5) * latitude_step;
+            const double sin_latitude = std::sin(latitude), cos_latitude = std::cos(latitude);
+
+            for (int col = 0; col < region.width; col++)
+            {
+                const double longitude = longitude_origin + (region.x + col + 0.5) * longitude_step;
+
+                // x to the right, y downwards and z forwards, rotated into the camera frame.
+                const double px = cos_latitude * std::sin(longitude), py = sin_latitude, pz = cos_latitude * std::cos(longitude);
+                const double ray[3] = {R[0] * px + R[1] * py + R[2] * pz,
+                                       R[3] * px + R[4] * py + R[5] * pz,
+                                       R[6] * px + R[7] * py + R[8] * pz};
+                double pixel[2];
+                if (model.Project(ray, pixel))
+                {
+                    map_x_row[col] = (float)pixel[0];
+                    map_y_row[col] = (float)pixel[1];
+                }
+                else
+                {
+                    map_x_row[col] = map_y_row[col] = -1;
+                }
+            }
+        }
+    }
+
+    // Remap tables of a pinhole view (new_intrinsic, rotated by rotation if not empty) into the
+    // image of the model, as used for the undistortion.
+    template <class Model>
+    void BuildPerspectiveMap(const Model &model, const cv::Mat &new_intrinsic, const cv::Mat &rotation,
+                             const cv::Size &size, cv::Mat &map_x, cv::Mat &map_y)
+    {
+        const PinholeModel view(new_intrinsic);
+        cv::Mat R = rotation.empty() ? cv::Mat::eye(3, 3, CV_64F) : rotation;
+        R.convertTo(R, CV_64F);
+        const double *r = R.ptr<double>();
+
+        map_x.create(size, CV_32FC1);
+        map_y.create(size, CV_32FC1);
+
+#pragma omp parallel for
+        for (int row = 0; row < size.height; row++)
+        {
+            float *map_x_row = map_x.ptr<float>(row);
+            float *map_y_row = map_y.ptr<float>(row);
+            for (int col = 0; col < size.width; col++)
+            {
+                double view_pixel[2] = {(double)col, (double)row}, view_ray[3], pixel[2];
+                view.Unproject(view_pixel, view_ray);
+                const double ray[3] = {r[0] * view_ray[0] + r[1] * view_ray[1] + r[2] * view_ray[2],
+                                       r[3] * view_ray[0] + r[4] * view_ray[1] + r[5] * view_ray[2],
+                                       r[6] * view_ray[0] + r[7] * view_ray[1] + r[8] * view_ray[2]};
+                if (model.Project(ray, pixel))
+                {
+                    map_x_row[col] = (float)pixel[0];
+                    map_y_row[col] = (float)pixel[1];
+                }
+                else
+                {
+                    map_x_row[col] = map_y_row[col] = -1;
+                }
+            }
+        }
+    }
+
+    // Remap tables of an epipolar-rectified equirectangular view into the image of the model, rotation takes
+    // the rectified frame into the camera frame. The column angle alpha leans from the plane normal to the
+    // baseline (the x axis) towards it, the row angle beta turns around it, so that both views of a point
+    // share the row and alpha grows along the row.
+    template <class Model>
+    void BuildEpipolarMap(const Model &model, const cv::Mat &rotation, const StereoSettings &settings,
+                          cv::Mat &map_x, cv::Mat &map_y)
+    {
+        cv::Mat R;
+        rotation.convertTo(R, CV_64F);
+        const double *r = R.ptr<double>();
+        const double alpha_step = settings.horizontal_fov * CV_PI / 180 / settings.output_size.width;
+        const double beta_step = settings.vertical_fov * CV_PI / 180 / settings.output_size.height;
+        const double alpha_origin = -0.5 * settings.horizontal_fov * CV_PI / 180;
+        const double beta_origin = -0.5 * settings.vertical_fov * CV_PI / 180;
+
+        map_x.create(settings.output_size, CV_32FC1);
+        map_y.create(settings.output_size, CV_32FC1);
+
+#pragma omp parallel for
+        for (int row = 0; row < settings.output_size.height; row++)
+        {
+            float *map_x_row = map_x.ptr<float>(row);
+            float *map_y_row = map_y.ptr<float>(row);
+            const double beta = beta_origin + (row + 0.5) * beta_step;
+            const double sin_beta = std::sin(beta), cos_beta = std::cos(beta);
+            for (int col = 0; col < settings.output_size.width; col++)
+            {
+                const double alpha = alpha_origin + (col + 0.5) * alpha_step;
+                const double px = std::sin(alpha), py = std::cos(alpha) * sin_beta, pz = std::cos(alpha) * cos_beta;
+                const double ray[3] = {r[0] * px + r[1] * py + r[2] * pz,
+                                       r[3] * px + r[4] * py + r[5] * pz,
+                                       r[6] * px + r[7] * py + r[8] * pz};
+                double pixel[2];
+                if (model.Project(ray, pixel))
+                {
+                    map_x_row[col] = (float)pixel[0];
+                    map_y_row[col] = (float)pixel[1];
+                }
+                else
+                {
+                    map_x_row[col] = map_y_row[col] = -1;
+                }
+            }
+        }
+    }
+
+    // Vignetting gain of every entry of the remap tables, from the incidence angle of its source pixel.
+    // Invalid entries get a zero gain.
+    template <class Model>
+    void BuildGainTable(const Model &model, const VignettingModel &vignetting,
+                        const cv::Mat &map_x, const cv::Mat &map_y, cv::Mat &gain)
+    {
+        gain.create(map_x.size(), CV_32FC1);
+
+#pragma omp parallel for
+        for (int row = 0; row < map_x.rows; row++)
+        {
+            const float *map_x_row = map_x.ptr<float>(row);
+            const float *map_y_row = map_y.ptr<float>(row);
+            float *gain_row = gain.ptr<float>(row);
+            for (int col = 0; col < map_x.cols; col++)
+            {
+                double pixel[2] = {map_x_row[col], map_y_row[col]}, ray[3];
+                if (pixel[0] < 0 || pixel[1] < 0 || !model.Unproject(pixel, ray))
+                {
+                    gain_row[col] = 0;
+                    continue;
+                }
+                gain_row[col] = (float)vignetting.Gain(std::acos(std::max(-1.0, std::min(1.0, ray[2]))));
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef REMAP_TABLE_FILE_H_
+#define REMAP_TABLE_FILE_H_
+
+#include <opencv2/core.hpp>
+
+#include "base/worker_process.h"
+
+namespace fishcat
+{
+    // Float remap tables (map_x, map_y and the optional per-entry tables) of one source size,
+    // written once and memory-mapped by every worker process of a segmented job, so the workers
+    // share the same pages instead of each building its own copy. Empty tables are kept empty.
+    bool WriteRemapTableFile(const std::string &filename, const cv::Size &source_size, const std::vector<cv::Mat> &tables);
+
+    class MappedRemapTables
+    {
+    public:
+        bool Open(const std::string &filename);
+
+        const cv::Size &SourceSize() const { return source_size_; }
+        // CV_32FC1 headers over the mapping, valid while this object lives.
+        const std::vector<cv::Mat> &Tables() const { return tables_; }
+
+    private:
+        MappedFile file_;
+        cv::Size source_size_;
+        std::vector<cv::Mat> tables_;
+    };
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef STEREO_DEPTH_H_
+#define STEREO_DEPTH_H_
+
+#include "calibration/calibration_base.h"
+#include "calibration/kb_inverse_model.h"
+#include "panoramic_process/fused_remap.h"
+
+namespace fishcat
+{
+    // Two calibrated KB cameras, a point X of the left frame is rotation * X + translation in the right one.
+    struct StereoRig
+    {
+        cv::Mat left_intrinsic, left_coefficients;
+        cv::Mat right_intrinsic, right_coefficients;
+        cv::Mat rotation, translation;
+        KBInverseModel left_inverse, right_inverse;
+        cv::Size image_size; // size of either image.
+    };
+
+    // Reads in1_intrinsic, in1_coff, in2_intrinsic, in2_coff, rotation and translation, the inverse
+    // models are fitted for image_size.
+    bool ReadStereoRig(const std::string &filename, const cv::Size &image_size, StereoRig &rig);
+
+    // Rotation taking the rectified frame into the left camera frame, its x axis is the baseline.
+    cv::Mat StereoRectificationRotation(const cv::Mat &rotation, const cv::Mat &translation);
+
+    // Depth from a fisheye pair. The rectification maps are built once, every frame is then gathered
+    // straight to gray, matched by semi-global matching over row strips in parallel and triangulated.
+    class StereoDepthEngine
+    {
+    public:
+        StereoDepthEngine(const StereoRig &rig, const StereoSettings &settings);
+
+        void Rectify(const cv::Mat &left, const cv::Mat &right, cv::Mat &left_rectified, cv::Mat &right_rectified) const;
+        // CV_16S disparity with 4 fractional bits as cv::StereoSGBM, negative where invalid.
+        void ComputeDisparity(const cv::Mat &left_rectified, const cv::Mat &right_rectified, cv::Mat &disparity) const;
+        // CV_32F distance from the left center along the ray, in the unit of the translation, 0 where invalid.
+        void DisparityToDepth(const cv::Mat &disparity, cv::Mat &depth) const;
+        void Process(const cv::Mat &left, const cv::Mat &right, cv::Mat &disparity, cv::Mat &depth) const;
+
+        double Baseline() const { return baseline_; }
+
+    private:
+        StereoSettings settings_;
+        cv::Mat left_map_x_, left_map_y_, right_map_x_, right_map_y_;
+        RemapTiling left_tiling_, right_tiling_;
+        double baseline_;
+        std::vector<double> column_alpha_; // alpha of the center of every column.
+    };
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+#include "base/job_scheduler.h"
+#include "base/log.h"
+
+namespace fishcat
+{
+    int JobScheduler::AddJob(const Task &task, const std::vector<int> &dependencies)
+    {
+        const int job = (int)jobs_.size();
+        jobs_.push_back(Job{task, std::vector<int>(), 0, JOB_PENDING, 0.0});
+        for (int dependency : dependencies)
+        {
+            if (dependency < 0 || dependency >= job)
+                continue;
+            jobs_[dependency].dependents.push_back(job);
+            jobs_[job].waiting++;
+        }
+        return job;
+    }
+
+    void JobScheduler::Run(int workers, const std::function<void(int)> &worker_init)
+    {
+        workers = std::max(1, std::min(workers, std::max(JobCount(), 1)));
+        queues_.clear();
+        for (int worker = 0; worker < workers; worker++)
+            queues_.emplace_back(new WorkerQueue());
+        queued_ = 0;
+        remaining_ = JobCount();
+
+        // the owner pops the newest job, so the jobs are dealt in reverse to start in the given order.
+        std::vector<int> initial_jobs;
+        for (int job = 0; job < JobCount(); job++)
+            if (jobs_[job].waiting == 0)
+                initial_jobs.push_back(job);
+        for (int i = 0; i < (int)initial_jobs.size(); i++)
+        {
+            const int job = initial_jobs[initial_jobs.size() - 1 - i];
+            queues_[(initial_jobs.size() - 1 - i) % workers]->jobs.push_back(job);
+            queued_++;
+        }
+
+        std::vector<std::thread> threads;
+        for (int worker = 0; worker < workers; worker++)
+            threads.emplace_back([this, worker, &worker_init]()
+                                 {
+                                     if (worker_init)
+                                         worker_init(worker);
+                                     WorkerLoop(worker); });
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    void JobScheduler::WorkerLoop(int worker)
+    {
+        while (true)
+        {
+            int job;
+            if (Pop(worker, job))
+            {
+                const auto start = std::chrono::steady_clock::now();
+                bool success = false;
+                try
+                {
+                    success = jobs_[job].task();
+                }
+                catch (const std::exception &error)
+                {
+                    LOG(ERROR) << "Job " << job << " failed: " << error.what() << std::endl;
+                }
+                catch (...)
+                {
+                    LOG(ERROR) << "Job " << job << " failed with an unknown exception." << std::endl;
+                }
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_[job].seconds = seconds;
+                Finish(worker, job, success ? JOB_SUCCEEDED : JOB_FAILED);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this]()
+                        { return queued_ > 0 || remaining_ == 0; });
+            if (remaining_ == 0)
+                break;
+        }
+        ready_.notify_all();
+    }
+
+    void JobScheduler::Push(int worker, int job)
+    {
+        std::lock_guard<std::mutex> lock(queues_[worker]->mutex);
+        queues_[worker]->jobs.push_back(job);
+    }
+
+    bool JobScheduler::Pop(int worker, int &job)
+    {
+        const int workers = (int)queues_.size();
+        bool found = false;
+        for (int i = 0; i < workers && !found; i++)
+        {
+            WorkerQueue &queue = *queues_[(worker + i) % workers];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                continue;
+            if (i == 0)
+            {
+                job = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+            else
+            {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+            }
+            found = true;
+        }
+        if (!found)
+            return false;
+
+        // a queue lock is never held while taking mutex_, Finish pushes the other way round.
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_--;
+        return true;
+    }
+
+    void JobScheduler::Finish(int worker, int job, JobState state)
+    {
+        jobs_[job].state = state;
+        remaining_--;
+        for (int dependent : jobs_[job].dependents)
+        {
+            if (jobs_[dependent].state != JOB_PENDING)
+                continue;
+            if (state != JOB_SUCCEEDED)
+            {
+                Finish(worker, dependent, JOB_SKIPPED);
+                continue;
+            }
+            if (--jobs_[dependent].waiting == 0)
+            {
+                Push(worker, dependent);
+                queued_++;
+            }
+        }
+        ready_.notify_all();
+    }
+}
@@ -1,3 +1,16 @@
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "base/log.h"
 
 void InitialGoogleLog(char **argv)
@@ -5,4 +18,155 @@ void InitialGoogleLog(char **argv)
     google::InitGoogleLogging(argv[0]);
     FLAGS_colorlogtostderr = true;
     FLAGS_logtostderr = 1;
-}
\ No newline at end of file
+}
+
+namespace fishcat
+{
+    namespace
+    {
+        const int kItemLogPeriod = 50; // ms between two drains of the buffers.
+
+        int64_t NowMicroseconds()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        // Owns the buffers of all the threads which ever logged, they live until the exit so the
+        // OpenMP pool threads, which are never joined, lose no line.
+        class ItemLogWriter
+        {
+        public:
+            static ItemLogWriter &Instance()
+            {
+                static ItemLogWriter writer;
+                return writer;
+            }
+
+            ItemLogBuffer *Register()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                buffers_.emplace_back(new ItemLogBuffer());
+                buffers_.back()->thread_id = (long)syscall(SYS_gettid);
+                if (!thread_.joinable())
+                    thread_ = std::thread(&ItemLogWriter::Run, this);
+                return buffers_.back().get();
+            }
+
+            void Drain()
+            {
+                std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    for (auto &buffer : buffers_)
+                    {
+                        // clear() keeps the capacity, the producer does not allocate again.
+                        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+                        pending_.append(buffer->text);
+                        buffer->text.clear();
+                    }
+                }
+                if (pending_.empty())
+                    return;
+                fwrite(pending_.data(), 1, pending_.size(), stderr);
+                fflush(stderr);
+                pending_.clear();
+            }
+
+            ~ItemLogWriter()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stop_ = true;
+                }
+                wake_.notify_one();
+                if (thread_.joinable())
+                    thread_.join();
+                Drain();
+            }
+
+        private:
+            ItemLogWriter() = default;
+
+            void Run()
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!stop_)
+                {
+                    wake_.wait_for(lock, std::chrono::milliseconds(kItemLogPeriod));
+                    lock.unlock();
+                    Drain();
+                    lock.lock();
+                }
+            }
+
+            std::mutex mutex_;       // guards buffers_, stop_ and the thread start.
+            std::mutex drain_mutex_; // guards pending_, drains of the writer and of FlushItemLog.
+            std::condition_variable wake_;
+            std::vector<std::unique_ptr<ItemLogBuffer>> buffers_;
+            std::string pending_;
+            std::thread thread_;
+            bool stop_ = false;
+        };
+    }
+
+    ItemLogBuffer &CurrentItemLogBuffer()
+    {
+        static thread_local ItemLogBuffer *buffer = ItemLogWriter::Instance().Register();
+        return *buffer;
+    }
+
+    void AppendItemLogPrefix(std::string &text, long thread_id)
+    {
+        timeval now;
+        gettimeofday(&now, nullptr);
+        tm local;
+        localtime_r(&now.tv_sec, &local);
+        char prefix[64];
+        const int length = snprintf(prefix, sizeof(prefix), "I%02d%02d %02d:%02d:%02d.%06ld %ld] ",
+                                    local.tm_mon + 1, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec,
+                                    (long)now.tv_usec, thread_id);
+        text.append(prefix, length);
+    }
+
+    void FlushItemLog()
+    {
+        ItemLogWriter::Instance().Drain();
+    }
+
+    ProgressLog::ProgressLog(const std::string &what, int64_t total, double interval)
+        : what_(what), total_(total), interval_((int64_t)(interval * 1e6)), start_(NowMicroseconds()),
+          done_(0), next_report_(start_ + interval_)
+    {
+    }
+
+    void ProgressLog::Step(int64_t items)
+    {
+        const int64_t done = done_.fetch_add(items, std::memory_order_relaxed) + items;
+        const int64_t now = NowMicroseconds();
+        int64_t next_report = next_report_.load(std::memory_order_relaxed);
+        // the thread which moves the deadline writes the line, the others go on.
+        if (now >= next_report &&
+            next_report_.compare_exchange_strong(next_report, now + interval_, std::memory_order_relaxed))
+            Report(done, now);
+    }
+
+    void ProgressLog::Finish()
+    {
+        FlushItemLog();
+        const int64_t done = done_.load();
+        const double seconds = std::max(NowMicroseconds() - start_, (int64_t)1) * 1e-6;
+        LOG(INFO) << what_ << ": " << done << " items in " << seconds << " s (" << done / seconds << " per second)."
+                  << std::endl;
+    }
+
+    void ProgressLog::Report(int64_t done, int64_t now)
+    {
+        const double rate = done / (std::max(now - start_, (int64_t)1) * 1e-6);
+        if (total_ > 0)
+            LogItem("{0}: {1}/{2}, {3} per second.", what_, done, total_, rate);
+        else
+            LogItem("{0}: {1}, {2} per second.", what_, done, rate);
+    }
+}
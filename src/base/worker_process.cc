@@ -0,0 +1,99 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdlib>
+
+#include "base/log.h"
+#include "base/worker_process.h"
+
+namespace fishcat
+{
+    bool RunWorkerProcesses(const std::string &executable, const std::vector<std::vector<std::string>> &arguments)
+    {
+        std::vector<pid_t> workers;
+        bool success = true;
+        for (const std::vector<std::string> &worker_arguments : arguments)
+        {
+            // the argument vector is built before the fork, the child only execs.
+            std::vector<char *> argv;
+            argv.push_back(const_cast<char *>(executable.c_str()));
+            for (const std::string &argument : worker_arguments)
+                argv.push_back(const_cast<char *>(argument.c_str()));
+            argv.push_back(nullptr);
+
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                execv(executable.c_str(), argv.data());
+                _exit(127);
+            }
+            if (pid < 0)
+            {
+                LOG(ERROR) << "Could not start a worker process of " << executable << std::endl;
+                success = false;
+                break;
+            }
+            workers.push_back(pid);
+        }
+
+        for (pid_t pid : workers)
+        {
+            int status = 0;
+            if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            {
+                LOG(ERROR) << "Worker process " << pid << " failed." << std::endl;
+                success = false;
+            }
+        }
+        return success;
+    }
+
+    std::string CurrentExecutable(const std::string &fallback)
+    {
+        char path[PATH_MAX];
+        ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (length <= 0)
+            return fallback;
+        path[length] = '\0';
+        return path;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string &filename)
+    {
+        Close();
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        void *data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        // the mapping stays valid after the descriptor is closed.
+        close(fd);
+        if (data == MAP_FAILED)
+            return false;
+        data_ = static_cast<unsigned char *>(data);
+        size_ = file_stat.st_size;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (data_)
+            munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
@@ -1,10 +1,54 @@
 #include <iostream>
 
 #include "calibration/calibration_base.h"
+#include "calibration/camera_models.h"
 #include "base/log.h"
+#include "base/string_format.h"
 
 namespace fishcat
 {
+    namespace
+    {
+        int ReducedGrayscaleFlag(int decode_scale)
+        {
+            switch (decode_scale)
+            {
+            case 2:
+                return cv::IMREAD_REDUCED_GRAYSCALE_2;
+            case 4:
+                return cv::IMREAD_REDUCED_GRAYSCALE_4;
+            case 8:
+                return cv::IMREAD_REDUCED_GRAYSCALE_8;
+            default:
+                return cv::IMREAD_GRAYSCALE;
+            }
+        }
+    }
+
+    ExpansionSettings::ExpansionSettings()
+        : output_size(2000, 1000), yaw(0), pitch(0), roll(0),
+          longitude_min(-180), longitude_max(180), latitude_min(-90), latitude_max(90),
+          output_format("BGR"), downscale(1), tile_size(64), antialias(false), workers(1)
+    {
+    }
+
+    StereoSettings::StereoSettings()
+        : output_size(1024, 512), horizontal_fov(180), vertical_fov(180),
+          num_disparities(64), block_size(5), strips(0), depth_scale(1000)
+    {
+    }
+
+    TargetlessSettings::TargetlessSettings()
+        : max_features(4000), match_ratio(0.8), inlier_angle(0.5), ransac_iterations(2000), baseline(0)
+    {
+    }
+
+    cv::Rect ExpansionSettings::OutputRegion() const
+    {
+        cv::Rect full(0, 0, output_size.width, output_size.height);
+        return roi.area() > 0 ? (roi & full) : full;
+    }
+
     // since the static is used only for intrinsic calibration.
     void read(const cv::FileNode &node, CalibrationSettings &x, const CalibrationSettings &default_value = CalibrationSettings())
     {
@@ -20,6 +64,8 @@ namespace fishcat
            << "BoardSize_Width" << board_size_.width
            << "BoardSize_Height" << board_size_.height
            << "Square_Size" << square_size_
+           << "Charuco_MarkerSize" << marker_size_
+           << "Charuco_Dictionary" << charuco_dictionary_
            << "Calibrate_Pattern" << pattern_to_use_
            << "Calibrate_FixAspectRatio" << aspect_ratio_
            << "Calibrate_AssumeZeroTangentialDistortion" << calib_zero_tangent_dist_
@@ -31,8 +77,20 @@ namespace fishcat
 
            << "Show_UndistortedImage" << show_undistorsed_
            << "Calibrate_UseFisheyeModel" << use_fisheye_model_
+           << "Camera_Model" << camera_model_name_
+           << "Camera_Registry" << camera_registry_
+           << "Camera_RegistryId" << camera_registry_id_
+           << "Camera_RegistryVersion" << camera_registry_version_
+           << "Calibrate_ViewSelection" << bview_selection_
+           << "ViewSelection_MaxViews" << view_selection_max_views_
+           << "ViewSelection_TimeBudget" << view_selection_time_budget_
+           << "ViewSelection_RefineFullSet" << bview_selection_refine_
+           << "Calibrate_Vignetting" << bcalibrate_vignetting_
 
            << "Input_FlipAroundHorizontalAxis" << flip_vertical_
+           << "Input_TrackCorners" << btrack_corners_
+           << "Input_DecodeScale" << decode_scale_
+           << "Input_SaddleRefiner" << bsaddle_refiner_
            << "Input_Path" << input_path_
            << "Image_Path" << image_path_
            << "Input" << input_
@@ -60,6 +118,56 @@ namespace fishcat
         node["Calibrate_UseFisheyeModel"] >> use_fisheye_model_;
         node["Calibration_Type"] >> calibration_type_;
 
+        // optional, keep the defaults when missing.
+        const ExpansionSettings default_expansion;
+        cv::read(node["Expansion_Width"], expansion_.output_size.width, default_expansion.output_size.width);
+        cv::read(node["Expansion_Height"], expansion_.output_size.height, default_expansion.output_size.height);
+        cv::read(node["Expansion_Yaw"], expansion_.yaw, default_expansion.yaw);
+        cv::read(node["Expansion_Pitch"], expansion_.pitch, default_expansion.pitch);
+        cv::read(node["Expansion_Roll"], expansion_.roll, default_expansion.roll);
+        cv::read(node["Expansion_LongitudeMin"], expansion_.longitude_min, default_expansion.longitude_min);
+        cv::read(node["Expansion_LongitudeMax"], expansion_.longitude_max, default_expansion.longitude_max);
+        cv::read(node["Expansion_LatitudeMin"], expansion_.latitude_min, default_expansion.latitude_min);
+        cv::read(node["Expansion_LatitudeMax"], expansion_.latitude_max, default_expansion.latitude_max);
+        cv::read(node["Expansion_ROI_X"], expansion_.roi.x, 0);
+        cv::read(node["Expansion_ROI_Y"], expansion_.roi.y, 0);
+        cv::read(node["Expansion_ROI_Width"], expansion_.roi.width, 0);
+        cv::read(node["Expansion_ROI_Height"], expansion_.roi.height, 0);
+        cv::read(node["Expansion_OutputFormat"], expansion_.output_format, default_expansion.output_format);
+        cv::read(node["Expansion_Downscale"], expansion_.downscale, default_expansion.downscale);
+        cv::read(node["Expansion_TileSize"], expansion_.tile_size, default_expansion.tile_size);
+        cv::read(node["Expansion_Antialias"], expansion_.antialias, default_expansion.antialias);
+        cv::read(node["Expansion_Workers"], expansion_.workers, default_expansion.workers);
+        const StereoSettings default_stereo;
+        cv::read(node["Stereo_Width"], stereo_.output_size.width, default_stereo.output_size.width);
+        cv::read(node["Stereo_Height"], stereo_.output_size.height, default_stereo.output_size.height);
+        cv::read(node["Stereo_HorizontalFov"], stereo_.horizontal_fov, default_stereo.horizontal_fov);
+        cv::read(node["Stereo_VerticalFov"], stereo_.vertical_fov, default_stereo.vertical_fov);
+        cv::read(node["Stereo_NumDisparities"], stereo_.num_disparities, default_stereo.num_disparities);
+        cv::read(node["Stereo_BlockSize"], stereo_.block_size, default_stereo.block_size);
+        cv::read(node["Stereo_Strips"], stereo_.strips, default_stereo.strips);
+        cv::read(node["Stereo_DepthScale"], stereo_.depth_scale, default_stereo.depth_scale);
+        const TargetlessSettings default_targetless;
+        cv::read(node["Targetless_Features"], targetless_.max_features, default_targetless.max_features);
+        cv::read(node["Targetless_MatchRatio"], targetless_.match_ratio, default_targetless.match_ratio);
+        cv::read(node["Targetless_InlierAngle"], targetless_.inlier_angle, default_targetless.inlier_angle);
+        cv::read(node["Targetless_RansacIterations"], targetless_.ransac_iterations, default_targetless.ransac_iterations);
+        cv::read(node["Targetless_Baseline"], targetless_.baseline, default_targetless.baseline);
+        cv::read(node["Camera_Model"], camera_model_name_, std::string("KANNALA_BRANDT"));
+        cv::read(node["Camera_Registry"], camera_registry_, std::string());
+        cv::read(node["Camera_RegistryId"], camera_registry_id_, std::string());
+        cv::read(node["Camera_RegistryVersion"], camera_registry_version_, -1);
+        cv::read(node["Input_TrackCorners"], btrack_corners_, false);
+        cv::read(node["Input_DecodeScale"], decode_scale_, 1);
+        cv::read(node["Input_SaddleRefiner"], bsaddle_refiner_, true);
+        cv::read(node["Charuco_MarkerSize"], marker_size_, 0.0f);
+        cv::read(node["Charuco_Dictionary"], charuco_dictionary_, 10); // DICT_6X6_250
+        cv::read(node["Calibrate_ViewSelection"], bview_selection_, false);
+        cv::read(node["ViewSelection_MaxViews"], view_selection_max_views_, 40);
+        cv::read(node["ViewSelection_TimeBudget"], view_selection_time_budget_, 0.0);
+        cv::read(node["ViewSelection_RefineFullSet"], bview_selection_refine_, false);
+        cv::read(node["Calibrate_Vignetting"], bcalibrate_vignetting_, false);
+
         if (calibration_type_ > 0)
         {
             node["Camera_Intrinsic_Path"] >> camera_intrinsic_path_;
@@ -80,6 +188,66 @@ namespace fishcat
             good_input_ = false;
         }
 
+        if (expansion_.output_size.width <= 0 || expansion_.output_size.height <= 0 ||
+            expansion_.longitude_max <= expansion_.longitude_min || expansion_.latitude_max <= expansion_.latitude_min)
+        {
+            LOG(ERROR) << "Invalid expansion output: " << expansion_.output_size.width << "x" << expansion_.output_size.height
+                       << " over longitude [" << expansion_.longitude_min << ", " << expansion_.longitude_max
+                       << "] and latitude [" << expansion_.latitude_min << ", " << expansion_.latitude_max << "]"
+                       << std::endl;
+            good_input_ = false;
+        }
+
+        if (stereo_.output_size.area() <= 0 || stereo_.horizontal_fov <= 0 || stereo_.horizontal_fov > 180 ||
+            stereo_.vertical_fov <= 0 || stereo_.vertical_fov > 360 ||
+            stereo_.num_disparities <= 0 || stereo_.num_disparities % 16 || stereo_.block_size < 1 || stereo_.block_size % 2 == 0)
+        {
+            LOG(ERROR) << "Invalid stereo settings: " << stereo_.output_size.width << "x" << stereo_.output_size.height
+                       << " over " << stereo_.horizontal_fov << "x" << stereo_.vertical_fov << " deg, "
+                       << stereo_.num_disparities << " disparities of block " << stereo_.block_size << std::endl;
+            good_input_ = false;
+        }
+
+        if (targetless_.max_features <= 0 || targetless_.match_ratio <= 0 || targetless_.match_ratio > 1 ||
+            targetless_.inlier_angle <= 0 || targetless_.ransac_iterations <= 0 || targetless_.baseline < 0)
+        {
+            LOG(ERROR) << "Invalid targetless settings: " << targetless_.max_features << " features, ratio "
+                       << targetless_.match_ratio << ", inlier angle " << targetless_.inlier_angle << " deg, "
+                       << targetless_.ransac_iterations << " iterations, baseline " << targetless_.baseline << std::endl;
+            good_input_ = false;
+        }
+
+        if (expansion_.downscale < 1)
+        {
+            LOG(ERROR) << "Invalid expansion downscale " << expansion_.downscale << std::endl;
+            good_input_ = false;
+        }
+
+        if (expansion_.tile_size < 0 || expansion_.tile_size % 2)
+        {
+            LOG(ERROR) << "Invalid expansion tile size " << expansion_.tile_size << ", should be even or 0." << std::endl;
+            good_input_ = false;
+        }
+
+        if (expansion_.workers < 1)
+        {
+            LOG(ERROR) << "Invalid number of expansion workers " << expansion_.workers << std::endl;
+            good_input_ = false;
+        }
+
+        if (ParseCameraModelType(camera_model_name_) == UNKNOWN_MODEL)
+        {
+            LOG(ERROR) << "Unknown camera model " << camera_model_name_
+                       << ", should be PINHOLE, KANNALA_BRANDT, UNIFIED, DOUBLE_SPHERE or FOV." << std::endl;
+            good_input_ = false;
+        }
+
+        if (decode_scale_ != 1 && decode_scale_ != 2 && decode_scale_ != 4 && decode_scale_ != 8)
+        {
+            LOG(ERROR) << "Invalid decode scale " << decode_scale_ << ", should be 1, 2, 4 or 8." << std::endl;
+            good_input_ = false;
+        }
+
         if (square_size_ <= 10e-6)
         {
             LOG(ERROR) << "Invalid square size " << square_size_ << std::endl;
@@ -88,11 +256,14 @@ namespace fishcat
 
         if (input_.empty()) // Check for valid input
             input_type_ = INVALID;
-        else
+        else if (ImageManifest::IsManifest(input_))
         {
-            ReadStringList(input_, image_list_);
-            input_type_ == IMAGE_LIST;
+            // image lists, directories and globs are streamed, everything else is opened as a video.
+            image_manifest_ = std::make_shared<ImageManifest>();
+            input_type_ = image_manifest_->Open(input_, image_path_) ? IMAGE_LIST : INVALID;
         }
+        else
+            input_type_ = input_capture_.open(input_) ? VIDEO_FILE : INVALID;
 
         if (input_type_ == INVALID)
         {
@@ -129,38 +300,127 @@ namespace fishcat
             calibration_pattern_ = CIRCLES_GRID;
         if (!pattern_to_use_.compare("ASYMMETRIC_CIRCLES_GRID"))
             calibration_pattern_ = ASYMMETRIC_CIRCLES_GRID;
+        if (!pattern_to_use_.compare("CHARUCO"))
+            calibration_pattern_ = CHARUCO;
         if (calibration_pattern_ == NOT_EXISTING)
         {
             LOG(ERROR) << " Inexistent camera calibration mode: " << pattern_to_use_ << std::endl;
             good_input_ = false;
         }
+
+        if (calibration_pattern_ == CHARUCO && (marker_size_ <= 0 || marker_size_ >= square_size_))
+        {
+            LOG(ERROR) << "Invalid ChArUco marker size " << marker_size_ << std::endl;
+            good_input_ = false;
+        }
+
+        if (bcalibrate_vignetting_ && (!use_fisheye_model_ || calibration_pattern_ != CHESSBOARD))
+        {
+            LOG(WARNING) << "The vignetting is only calibrated from chessboards with the fisheye model, it is skipped."
+                         << std::endl;
+            bcalibrate_vignetting_ = false;
+        }
         at_image_list_ = 0;
+        input_finished_ = false;
     }
 
     cv::Mat CalibrationSettings::NextImage()
     {
         cv::Mat result;
-        std::string image_path = "";
-        if (at_image_list_ < (int)image_list_.size())
+        current_gray_image_.release();
+        current_image_path_.clear();
+        if (input_type_ == VIDEO_FILE)
         {
-            image_path = image_path_ + image_list_[at_image_list_++];
-            result = cv::imread(image_path, cv::IMREAD_COLOR);
+            if (!input_capture_.read(result))
+                input_finished_ = true;
+            current_image_name_ = "frame_" + std::to_string(at_image_list_++);
+        }
+        else if (image_manifest_ && image_manifest_->Next(current_image_name_, current_image_path_))
+        {
+            at_image_list_++;
+            result = cv::imread(current_image_path_, cv::IMREAD_COLOR);
         }
         return result;
     }
 
-    bool CalibrationSettings::ReadStringList(const std::string &filename, std::vector<std::string> &l)
+    cv::Mat CalibrationSettings::NextGrayImage(int decode_scale)
     {
-        l.clear();
-        cv::FileStorage fs(filename, cv::FileStorage::READ);
-        if (!fs.isOpened())
+        cv::Mat result;
+        if (input_type_ == VIDEO_FILE)
+        {
+            // frames are decoded whole, only the color conversion and the detection get cheaper.
+            cv::Mat frame = NextImage();
+            if (frame.empty())
+                return result;
+            cv::cvtColor(frame, current_gray_image_, cv::COLOR_BGR2GRAY);
+            if (decode_scale > 1)
+                cv::resize(current_gray_image_, result, cv::Size(), 1.0 / decode_scale, 1.0 / decode_scale, cv::INTER_AREA);
+            else
+                result = current_gray_image_;
+            return result;
+        }
+
+        current_gray_image_.release();
+        current_image_path_.clear();
+        if (image_manifest_ && image_manifest_->Next(current_image_name_, current_image_path_))
+        {
+            at_image_list_++;
+            result = cv::imread(current_image_path_, ReducedGrayscaleFlag(decode_scale));
+            if (decode_scale <= 1)
+                current_gray_image_ = result;
+        }
+        return result;
+    }
+
+    cv::Mat CalibrationSettings::CurrentGrayImage()
+    {
+        if (current_gray_image_.empty() && !current_image_path_.empty())
+            current_gray_image_ = cv::imread(current_image_path_, cv::IMREAD_GRAYSCALE);
+        return current_gray_image_;
+    }
+
+    bool CalibrationSettings::HasNextImage() const
+    {
+        if (input_type_ == VIDEO_FILE)
+            return input_capture_.isOpened() && !input_finished_;
+        return image_manifest_ && image_manifest_->HasNext();
+    }
+
+    int CalibrationSettings::ImageCount() const
+    {
+        if (input_type_ == VIDEO_FILE)
+            return (int)input_capture_.get(cv::CAP_PROP_FRAME_COUNT);
+        return image_manifest_ ? image_manifest_->Count() : 0;
+    }
+
+    bool CalibrationSettings::SeekFrame(int frame)
+    {
+        if (frame < 0 || frame > ImageCount())
             return false;
-        cv::FileNode n = fs.getFirstTopLevelNode();
-        if (n.type() != cv::FileNode::SEQ)
+        if (input_type_ == VIDEO_FILE)
+        {
+            // some backends land on a nearby keyframe, the position is read back and the frames up to the
+            // requested one are decoded. A position past it restarts from the first frame.
+            if (!input_capture_.set(cv::CAP_PROP_POS_FRAMES, frame))
+                return false;
+            int position = (int)input_capture_.get(cv::CAP_PROP_POS_FRAMES);
+            if (position < 0 || position > frame)
+            {
+                if (!input_capture_.set(cv::CAP_PROP_POS_FRAMES, 0) ||
+                    (int)input_capture_.get(cv::CAP_PROP_POS_FRAMES) != 0)
+                    return false;
+                position = 0;
+            }
+            for (; position < frame; position++)
+            {
+                if (!input_capture_.grab())
+                    return false;
+            }
+        }
+        if (input_type_ == IMAGE_LIST && !image_manifest_->Seek(frame))
             return false;
-        cv::FileNodeIterator it = n.begin(), it_end = n.end();
-        for (; it != it_end; ++it)
-            l.push_back((std::string)*it);
+        at_image_list_ = frame;
+        input_finished_ = false;
         return true;
     }
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include "calibration/camera_models.h"
+
+namespace fishcat
+{
+    CameraModelType ParseCameraModelType(const std::string &name)
+    {
+        if (name == "PINHOLE")
+            return PINHOLE;
+        if (name == "KANNALA_BRANDT" || name.empty())
+            return KANNALA_BRANDT;
+        if (name == "UNIFIED")
+            return UNIFIED;
+        if (name == "DOUBLE_SPHERE")
+            return DOUBLE_SPHERE;
+        if (name == "FOV")
+            return FOV;
+        return UNKNOWN_MODEL;
+    }
+
+    const char *CameraModelName(CameraModelType type)
+    {
+        switch (type)
+        {
+        case PINHOLE:
+            return "PINHOLE";
+        case KANNALA_BRANDT:
+            return "KANNALA_BRANDT";
+        case UNIFIED:
+            return "UNIFIED";
+        case DOUBLE_SPHERE:
+            return "DOUBLE_SPHERE";
+        case FOV:
+            return "FOV";
+        default:
+            return "UNKNOWN_MODEL";
+        }
+    }
+}
@@ -0,0 +1,427 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "base/log.h"
+#include "calibration/camera_registry.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const uint32_t kRegistryMagic = 0x52434346; // "FCCR"
+        const uint32_t kRegistryVersion = 2;
+        const int kIdLength = 64;
+        const int kPathLength = 256;
+        const int kMaxCoefficients = 14; // the rational, thin prism and tilted OpenCV model.
+        const int kMaxInverseCoefficients = 16;
+        const int kMaxVignettingCoefficients = 8;
+
+        // layout: the header, buckets int32 indices of the latest record of an id (-1 for none), padded
+        // to 8 bytes, then count records. All the fields are naturally aligned in the mapping.
+        struct RegistryHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            int32_t count;
+            int32_t buckets; // a power of 2, at least twice the number of ids.
+        };
+
+        struct RegistryRecord
+        {
+            char id[kIdLength];
+            int32_t version;
+            int32_t model_type;
+            int32_t width, height;
+            int32_t coefficient_count;
+            int32_t inverse_count;
+            int32_t vignetting_count;
+            int32_t older; // record of the next older version of the id, -1 for none.
+            double intrinsic[9];
+            double coefficients[kMaxCoefficients];
+            double inverse[kMaxInverseCoefficients];
+            double inverse_max_theta, inverse_max_radius, inverse_max_error;
+            double vignetting[kMaxVignettingCoefficients];
+            double vignetting_max_theta;
+            uint64_t remap_key;
+            char remap_tables[kPathLength];
+        };
+
+        size_t RecordsOffset(int buckets)
+        {
+            return (sizeof(RegistryHeader) + buckets * sizeof(int32_t) + 7) / 8 * 8;
+        }
+
+        bool PackRecord(const CameraRecord &camera, RegistryRecord &record)
+        {
+            memset(&record, 0, sizeof(record));
+            if (camera.id.empty() || (int)camera.id.size() >= kIdLength ||
+                (int)camera.remap_tables.size() >= kPathLength || camera.intrinsic.total() != 9 ||
+                (int)camera.coefficients.total() > kMaxCoefficients ||
+                (int)camera.inverse_model.coefficients.size() > kMaxInverseCoefficients ||
+                (int)camera.vignetting.coefficients.size() > kMaxVignettingCoefficients)
+            {
+                LOG(ERROR) << "The camera \"" << camera.id << "\" does not fit a registry record: at most " << kIdLength - 1
+                           << " characters of id, " << kPathLength - 1 << " of remap table path, " << kMaxCoefficients
+                           << " distortion, " << kMaxInverseCoefficients << " inverse and " << kMaxVignettingCoefficients
+                           << " vignetting coefficients." << std::endl;
+                return false;
+            }
+            strncpy(record.id, camera.id.c_str(), kIdLength - 1);
+            record.version = camera.version;
+            record.model_type = camera.model_type;
+            record.width = camera.image_size.width;
+            record.height = camera.image_size.height;
+            record.older = -1;
+
+            cv::Mat intrinsic, coefficients;
+            camera.intrinsic.convertTo(intrinsic, CV_64F);
+            std::copy(intrinsic.ptr<double>(), intrinsic.ptr<double>() + 9, record.intrinsic);
+            if (!camera.coefficients.empty())
+            {
+                camera.coefficients.convertTo(coefficients, CV_64F);
+                coefficients = coefficients.reshape(1, 1).clone();
+                record.coefficient_count = (int32_t)coefficients.total();
+                std::copy(coefficients.ptr<double>(), coefficients.ptr<double>() + coefficients.total(), record.coefficients);
+            }
+
+            record.inverse_count = (int32_t)camera.inverse_model.coefficients.size();
+            std::copy(camera.inverse_model.coefficients.begin(), camera.inverse_model.coefficients.end(), record.inverse);
+            record.inverse_max_theta = camera.inverse_model.max_theta;
+            record.inverse_max_radius = camera.inverse_model.max_radius;
+            record.inverse_max_error = camera.inverse_model.max_error;
+            record.vignetting_count = (int32_t)camera.vignetting.coefficients.size();
+            std::copy(camera.vignetting.coefficients.begin(), camera.vignetting.coefficients.end(), record.vignetting);
+            record.vignetting_max_theta = camera.vignetting.max_theta;
+            record.remap_key = camera.remap_key;
+            strncpy(record.remap_tables, camera.remap_tables.c_str(), kPathLength - 1);
+            return true;
+        }
+
+        void UnpackRecord(const RegistryRecord &record, CameraRecord &camera)
+        {
+            camera.id = std::string(record.id, strnlen(record.id, kIdLength));
+            camera.version = record.version;
+            camera.model_type = (CameraModelType)record.model_type;
+            camera.image_size = cv::Size(record.width, record.height);
+            camera.intrinsic = cv::Mat(3, 3, CV_64F, (void *)record.intrinsic).clone();
+            camera.coefficients = record.coefficient_count > 0
+                                      ? cv::Mat(record.coefficient_count, 1, CV_64F, (void *)record.coefficients).clone()
+                                      : cv::Mat();
+            camera.inverse_model.coefficients.assign(record.inverse, record.inverse + record.inverse_count);
+            camera.inverse_model.max_theta = record.inverse_max_theta;
+            camera.inverse_model.max_radius = record.inverse_max_radius;
+            camera.inverse_model.max_error = record.inverse_max_error;
+            camera.vignetting.coefficients.assign(record.vignetting, record.vignetting + record.vignetting_count);
+            camera.vignetting.max_theta = record.vignetting_max_theta;
+            camera.remap_tables = std::string(record.remap_tables, strnlen(record.remap_tables, kPathLength));
+            camera.remap_key = record.remap_key;
+        }
+
+        bool ReadCameraNode(const cv::FileNode &node, const std::string &default_id, CameraModelType default_model,
+                            CameraRecord &camera)
+        {
+            std::string model, remap_key;
+            cv::read(node["Camera_Id"], camera.id, default_id);
+            cv::read(node["Camera_Version"], camera.version, 1);
+            cv::read(node["Camera_Model"], model, std::string());
+            camera.model_type = model.empty() ? default_model : ParseCameraModelType(model);
+            cv::read(node["image_Width"], camera.image_size.width, 0);
+            cv::read(node["image_Height"], camera.image_size.height, 0);
+
+            node["Camera_Matrix"] >> camera.intrinsic;
+            node["Distortion_Coefficients"] >> camera.coefficients;
+            if (camera.intrinsic.empty())
+            {
+                node["in1_intrinsic"] >> camera.intrinsic;
+                node["in1_coff"] >> camera.coefficients;
+            }
+            if (camera.intrinsic.total() != 9 || camera.model_type == UNKNOWN_MODEL)
+                return false;
+            camera.intrinsic.convertTo(camera.intrinsic, CV_64F);
+            if (!camera.coefficients.empty())
+                camera.coefficients.convertTo(camera.coefficients, CV_64F);
+
+            camera.inverse_model = KBInverseModel();
+            if (!ReadKBInverseModel(node, camera.inverse_model))
+                camera.inverse_model.coefficients.clear();
+            camera.vignetting = VignettingModel();
+            if (!ReadVignettingModel(node, camera.vignetting))
+                camera.vignetting.coefficients.clear();
+
+            // FileStorage has no 64-bit integer, the key is kept in hexadecimal.
+            cv::read(node["Remap_Tables"], camera.remap_tables, std::string());
+            cv::read(node["Remap_Key"], remap_key, std::string("0"));
+            camera.remap_key = strtoull(remap_key.c_str(), nullptr, 16);
+            return true;
+        }
+    }
+
+    uint64_t CameraRegistryHash(const void *data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        const unsigned char *bytes = (const unsigned char *)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t CameraRegistryHash(const std::string &text)
+    {
+        return CameraRegistryHash(text.data(), text.size());
+    }
+
+    bool ReadCameraFile(const std::string &filename, CameraRecord &camera, CameraModelType default_model)
+    {
+        cv::FileStorage fs(filename, cv::FileStorage::READ);
+        if (!fs.isOpened())
+        {
+            LOG(ERROR) << "Could not open the camera file: " << filename << std::endl;
+            return false;
+        }
+        const std::string name = filename.substr(filename.rfind('/') + 1);
+        if (!ReadCameraNode(fs.root(), name.substr(0, name.rfind('.')), default_model, camera))
+        {
+            LOG(ERROR) << "The camera file " << filename << " misses the intrinsics or has an unknown model." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadCameraList(const std::string &filename, std::vector<CameraRecord> &cameras)
+    {
+        cv::FileStorage fs(filename, cv::FileStorage::READ);
+        if (!fs.isOpened())
+        {
+            LOG(ERROR) << "Could not open the camera list: " << filename << std::endl;
+            return false;
+        }
+        const cv::FileNode list = fs["Cameras"];
+        if (list.type() != cv::FileNode::SEQ)
+        {
+            fs.release();
+            CameraRecord camera;
+            if (!ReadCameraFile(filename, camera))
+                return false;
+            cameras.push_back(camera);
+            return true;
+        }
+
+        for (cv::FileNodeIterator it = list.begin(); it != list.end(); ++it)
+        {
+            CameraRecord camera;
+            if (!ReadCameraNode(*it, std::string(), KANNALA_BRANDT, camera) || camera.id.empty())
+            {
+                LOG(ERROR) << "Camera " << cameras.size() << " of " << filename << " misses its id or intrinsics."
+                           << std::endl;
+                return false;
+            }
+            cameras.push_back(camera);
+        }
+        return true;
+    }
+
+    bool WriteCameraList(const std::string &filename, const std::vector<CameraRecord> &cameras)
+    {
+        cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+        if (!fs.isOpened())
+        {
+            LOG(ERROR) << "Could not write the camera list: " << filename << std::endl;
+            return false;
+        }
+        fs << "Cameras"
+           << "[";
+        for (const CameraRecord &camera : cameras)
+        {
+            char remap_key[32];
+            snprintf(remap_key, sizeof(remap_key), "%016llx", (unsigned long long)camera.remap_key);
+            fs << "{"
+               << "Camera_Id" << camera.id
+               << "Camera_Version" << camera.version
+               << "Camera_Model" << CameraModelName(camera.model_type)
+               << "image_Width" << camera.image_size.width
+               << "image_Height" << camera.image_size.height
+               << "Camera_Matrix" << camera.intrinsic
+               << "Distortion_Coefficients" << camera.coefficients;
+            if (!camera.inverse_model.coefficients.empty())
+                WriteKBInverseModel(fs, camera.inverse_model);
+            if (!camera.vignetting.coefficients.empty())
+                WriteVignettingModel(fs, camera.vignetting);
+            if (!camera.remap_tables.empty())
+                fs << "Remap_Tables" << camera.remap_tables
+                   << "Remap_Key" << remap_key;
+            fs << "}";
+        }
+        fs << "]";
+        return true;
+    }
+
+    bool WriteCameraRegistry(const std::string &filename, const std::vector<CameraRecord> &cameras)
+    {
+        // the versions of an id are chained from the latest one, which the index points to.
+        std::vector<int> order(cameras.size());
+        for (int i = 0; i < (int)order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&cameras](int a, int b)
+                  { return cameras[a].id != cameras[b].id ? cameras[a].id < cameras[b].id
+                                                          : cameras[a].version > cameras[b].version; });
+
+        std::vector<RegistryRecord> records(cameras.size());
+        for (int i = 0; i < (int)order.size(); i++)
+        {
+            if (!PackRecord(cameras[order[i]], records[i]))
+                return false;
+            if (i > 0 && cameras[order[i]].id == cameras[order[i - 1]].id)
+            {
+                if (cameras[order[i]].version == cameras[order[i - 1]].version)
+                {
+                    LOG(ERROR) << "The camera " << cameras[order[i]].id << " has the version "
+                               << cameras[order[i]].version << " twice." << std::endl;
+                    return false;
+                }
+                records[i - 1].older = i;
+            }
+        }
+
+        int buckets = 16;
+        while (buckets < 2 * (int)records.size())
+            buckets *= 2;
+        std::vector<int32_t> index(buckets, -1);
+        for (int i = 0; i < (int)records.size(); i++)
+        {
+            if (i > 0 && cameras[order[i]].id == cameras[order[i - 1]].id)
+                continue;
+            uint64_t bucket = CameraRegistryHash(cameras[order[i]].id) & (buckets - 1);
+            while (index[bucket] >= 0)
+                bucket = (bucket + 1) & (buckets - 1);
+            index[bucket] = i;
+        }
+
+        const RegistryHeader header = {kRegistryMagic, kRegistryVersion, (int32_t)records.size(), buckets};
+        std::vector<char> padding(RecordsOffset(buckets) - sizeof(header) - buckets * sizeof(int32_t), 0);
+        std::ofstream file(filename.c_str(), std::ios::binary);
+        file.write((const char *)&header, sizeof(header));
+        file.write((const char *)index.data(), index.size() * sizeof(int32_t));
+        file.write(padding.data(), padding.size());
+        file.write((const char *)records.data(), records.size() * sizeof(RegistryRecord));
+        if (!file)
+        {
+            LOG(ERROR) << "Could not write the camera registry " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool CameraRegistry::Open(const std::string &filename)
+    {
+        count_ = buckets_ = 0;
+        if (!file_.Open(filename))
+        {
+            LOG(ERROR) << "Could not map the camera registry " << filename << std::endl;
+            return false;
+        }
+
+        const RegistryHeader *header = (const RegistryHeader *)file_.Data();
+        if (file_.Size() < sizeof(RegistryHeader) || header->magic != kRegistryMagic || header->version != kRegistryVersion)
+        {
+            LOG(ERROR) << filename << " is not a camera registry." << std::endl;
+            return false;
+        }
+        if (header->count < 0 || header->buckets <= 0 || (header->buckets & (header->buckets - 1)) != 0 ||
+            file_.Size() < RecordsOffset(header->buckets) + header->count * sizeof(RegistryRecord))
+        {
+            LOG(ERROR) << "Truncated camera registry " << filename << std::endl;
+            return false;
+        }
+
+        // a corrupt index or link would read past the mapping, the older links only go forward so a
+        // version chain always ends.
+        const int32_t *index = (const int32_t *)(file_.Data() + sizeof(RegistryHeader));
+        const RegistryRecord *records = (const RegistryRecord *)(file_.Data() + RecordsOffset(header->buckets));
+        for (int bucket = 0; bucket < header->buckets; bucket++)
+        {
+            if (index[bucket] < -1 || index[bucket] >= header->count)
+            {
+                LOG(ERROR) << "Corrupt index in the camera registry " << filename << std::endl;
+                return false;
+            }
+        }
+        for (int i = 0; i < header->count; i++)
+        {
+            const RegistryRecord &record = records[i];
+            if ((record.older != -1 && (record.older <= i || record.older >= header->count)) ||
+                record.coefficient_count < 0 || record.coefficient_count > kMaxCoefficients ||
+                record.inverse_count < 0 || record.inverse_count > kMaxInverseCoefficients ||
+                record.vignetting_count < 0 || record.vignetting_count > kMaxVignettingCoefficients)
+            {
+                LOG(ERROR) << "Corrupt record " << i << " in the camera registry " << filename << std::endl;
+                return false;
+            }
+        }
+
+        count_ = header->count;
+        buckets_ = header->buckets;
+        index_ = index;
+        records_ = (const unsigned char *)records;
+        return true;
+    }
+
+    int CameraRegistry::FindIndex(const std::string &id) const
+    {
+        if (buckets_ == 0)
+            return -1;
+        uint64_t bucket = CameraRegistryHash(id) & (buckets_ - 1);
+        for (int probe = 0; probe < buckets_ && index_[bucket] >= 0; probe++)
+        {
+            const RegistryRecord &record = ((const RegistryRecord *)records_)[index_[bucket]];
+            if (strncmp(record.id, id.c_str(), kIdLength) == 0)
+                return index_[bucket];
+            bucket = (bucket + 1) & (buckets_ - 1);
+        }
+        return -1;
+    }
+
+    bool CameraRegistry::Find(const std::string &id, CameraRecord &camera, int version) const
+    {
+        const RegistryRecord *records = (const RegistryRecord *)records_;
+        int index = FindIndex(id);
+        while (index >= 0 && version >= 0 && records[index].version != version)
+            index = records[index].older;
+        if (index < 0)
+            return false;
+        UnpackRecord(records[index], camera);
+        return true;
+    }
+
+    bool CameraRegistry::Record(int index, CameraRecord &camera) const
+    {
+        if (index < 0 || index >= count_)
+            return false;
+        UnpackRecord(((const RegistryRecord *)records_)[index], camera);
+        return true;
+    }
+
+    bool ReadSettingsCamera(const CalibrationSettings &s, CameraRecord &camera)
+    {
+        if (s.camera_registry_.empty())
+        {
+            // the settings choose the model of a camera file without Camera_Model.
+            return ReadCameraFile(s.camera_intrinsic_path_, camera, ParseCameraModelType(s.camera_model_name_));
+        }
+
+        CameraRegistry registry;
+        if (!registry.Open(s.camera_registry_))
+            return false;
+        if (!registry.Find(s.camera_registry_id_, camera, s.camera_registry_version_))
+        {
+            LOG(ERROR) << "No camera " << s.camera_registry_id_ << " (version " << s.camera_registry_version_
+                       << ") in the registry " << s.camera_registry_ << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <opencv2/video/tracking.hpp>
+
+#include "base/log.h"
+#include "calibration/corner_tracker.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const cv::Size kFlowWindow(21, 21);
+        const int kFlowLevels = 3;
+        const int kRedetectInterval = 30;      // frames tracked before a full detection is tried again.
+        const double kMaxLocalResidual = 0.15; // relative to the distance of the closest image neighbor.
+        const double kMinKeptRatio = 0.8;      // of the points of the previous frame.
+        const int kMinTrackedPoints = 6;
+        const double kMinKeyframeMotion = 0.03; // median corner motion, relative to the image diagonal.
+    }
+
+    CornerTracker::CornerTracker(PatternDetector &detector)
+        : tracked_frames_(0), detected_frames_(0), keyframes_(0), detector_(detector), frames_since_detection_(0)
+    {
+        const std::vector<cv::Point3f> &board = detector_.BoardPoints();
+        board_spacing_ = std::numeric_limits<double>::max();
+        for (int i = 0; i < (int)board.size(); i++)
+            for (int j = i + 1; j < (int)board.size(); j++)
+            {
+                double dx = board[i].x - board[j].x, dy = board[i].y - board[j].y;
+                board_spacing_ = std::min(board_spacing_, std::sqrt(dx * dx + dy * dy));
+            }
+
+        // the neighborhoods are fixed by the board, so every frame only looks them up.
+        board_neighbors_.resize(board.size());
+        for (int i = 0; i < (int)board.size(); i++)
+            for (int j = 0; j < (int)board.size(); j++)
+            {
+                double dx = board[i].x - board[j].x, dy = board[i].y - board[j].y;
+                if (j != i && std::sqrt(dx * dx + dy * dy) <= 1.5 * board_spacing_)
+                    board_neighbors_[i].push_back(j);
+            }
+        keyframe_points_.assign(board.size(), cv::Point2f(-1, -1));
+    }
+
+    void CornerTracker::Reset()
+    {
+        previous_pyramid_.clear();
+        previous_points_.clear();
+        previous_ids_.clear();
+        frames_since_detection_ = 0;
+    }
+
+    bool CornerTracker::IsKeyframe(const std::vector<cv::Point2f> &points, const std::vector<int> &point_ids,
+                                   const cv::Size &image_size)
+    {
+        // a board entering or leaving the view changes the shared corners, a moving one their positions.
+        std::vector<float> motions;
+        motions.reserve(points.size());
+        for (int i = 0; i < (int)points.size(); i++)
+        {
+            const cv::Point2f &keyframe_point = keyframe_points_[point_ids[i]];
+            if (keyframe_point.x >= 0)
+                motions.push_back((float)cv::norm(points[i] - keyframe_point));
+        }
+        bool keyframe = motions.size() < kMinKeptRatio * points.size();
+        if (!keyframe)
+        {
+            std::nth_element(motions.begin(), motions.begin() + motions.size() / 2, motions.end());
+            const double diagonal = std::sqrt((double)image_size.width * image_size.width +
+                                              (double)image_size.height * image_size.height);
+            keyframe = motions[motions.size() / 2] >= kMinKeyframeMotion * diagonal;
+        }
+        if (!keyframe)
+            return false;
+
+        keyframe_points_.assign(keyframe_points_.size(), cv::Point2f(-1, -1));
+        for (int i = 0; i < (int)points.size(); i++)
+            keyframe_points_[point_ids[i]] = points[i];
+        keyframes_++;
+        return true;
+    }
+
+    bool CornerTracker::Process(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                                std::vector<float> *confidences)
+    {
+        // the pyramid of this frame is kept as the previous one of the next frame.
+        std::vector<cv::Mat> pyramid;
+        cv::buildOpticalFlowPyramid(gray, pyramid, kFlowWindow, kFlowLevels);
+
+        const bool has_previous = !previous_points_.empty();
+        const bool redetect = !has_previous || frames_since_detection_ >= kRedetectInterval;
+        bool found = false, detected = false;
+
+        if (redetect)
+            found = detected = detector_.Detect(gray, points, point_ids, confidences);
+        if (!found && has_previous)
+            found = Track(pyramid, gray, points, point_ids, confidences);
+        if (!found && !redetect)
+            found = detected = detector_.Detect(gray, points, point_ids, confidences);
+
+        if (!found)
+        {
+            Reset();
+            return false;
+        }
+
+        if (detected)
+        {
+            detected_frames_++;
+            frames_since_detection_ = 0;
+        }
+        else
+        {
+            tracked_frames_++;
+            frames_since_detection_++;
+        }
+        previous_pyramid_.swap(pyramid);
+        previous_points_ = points;
+        previous_ids_ = point_ids;
+        return true;
+    }
+
+    bool CornerTracker::Track(const std::vector<cv::Mat> &pyramid, const cv::Mat &gray,
+                              std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                              std::vector<float> *confidences)
+    {
+        std::vector<cv::Point2f> predicted_points;
+        std::vector<uchar> status;
+        std::vector<float> error;
+        cv::calcOpticalFlowPyrLK(previous_pyramid_, pyramid, previous_points_, predicted_points, status, error,
+                                 kFlowWindow, kFlowLevels);
+
+        points.clear();
+        point_ids.clear();
+        for (int i = 0; i < (int)predicted_points.size(); i++)
+        {
+            const cv::Point2f &point = predicted_points[i];
+            if (status[i] && point.x >= 0 && point.y >= 0 && point.x <= gray.cols - 1 && point.y <= gray.rows - 1)
+            {
+                points.push_back(point);
+                point_ids.push_back(previous_ids_[i]);
+            }
+        }
+
+        // complete boards must keep every point, partial ones may lose a few at the border.
+        int rejected = (int)(previous_points_.size() - points.size()) + RejectLocalOutliers(points, point_ids);
+        if (!detector_.SupportsPartial() && rejected > 0)
+            return false;
+        if ((int)points.size() < kMinTrackedPoints || points.size() < kMinKeptRatio * previous_points_.size())
+            return false;
+
+        detector_.RefinePoints(gray, points, confidences);
+        return true;
+    }
+
+    int CornerTracker::RejectLocalOutliers(std::vector<cv::Point2f> &points, std::vector<int> &point_ids) const
+    {
+        const std::vector<cv::Point3f> &board = detector_.BoardPoints();
+        std::vector<uchar> inlier(points.size(), 1);
+        std::vector<int> index_of_id(board.size(), -1);
+        for (int i = 0; i < (int)points.size(); i++)
+            index_of_id[point_ids[i]] = i;
+
+#pragma omp parallel for
+        for (int i = 0; i < (int)points.size(); i++)
+        {
+            // the 8-neighborhood on the board is close to planar-projective even under fisheye distortion.
+            const cv::Point3f &center = board[point_ids[i]];
+            std::vector<cv::Point2f> board_neighbors, image_neighbors;
+            double closest = std::numeric_limits<double>::max();
+            for (int neighbor_id : board_neighbors_[point_ids[i]])
+            {
+                const int j = index_of_id[neighbor_id];
+                if (j < 0)
+                    continue;
+                const cv::Point3f &neighbor = board[neighbor_id];
+                board_neighbors.push_back(cv::Point2f(neighbor.x, neighbor.y));
+                image_neighbors.push_back(points[j]);
+                closest = std::min(closest, (double)cv::norm(points[j] - points[i]));
+            }
+            if (board_neighbors.size() < 4)
+                continue;
+
+            cv::Mat H = cv::findHomography(board_neighbors, image_neighbors);
+            if (H.empty())
+                continue;
+
+            double w = H.at<double>(2, 0) * center.x + H.at<double>(2, 1) * center.y + H.at<double>(2, 2);
+            double u = (H.at<double>(0, 0) * center.x + H.at<double>(0, 1) * center.y + H.at<double>(0, 2)) / w;
+            double v = (H.at<double>(1, 0) * center.x + H.at<double>(1, 1) * center.y + H.at<double>(1, 2)) / w;
+            double residual = std::sqrt((u - points[i].x) * (u - points[i].x) + (v - points[i].y) * (v - points[i].y));
+            if (residual > kMaxLocalResidual * closest)
+                inlier[i] = 0;
+        }
+
+        int kept = 0;
+        for (int i = 0; i < (int)points.size(); i++)
+        {
+            if (!inlier[i])
+                continue;
+            points[kept] = points[i];
+            point_ids[kept] = point_ids[i];
+            kept++;
+        }
+        int rejected = (int)points.size() - kept;
+        points.resize(kept);
+        point_ids.resize(kept);
+        return rejected;
+    }
+}
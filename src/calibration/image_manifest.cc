@@ -0,0 +1,196 @@
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "base/log.h"
+#include "base/string_format.h"
+#include "calibration/image_manifest.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        std::string Extension(const std::string &filename)
+        {
+            std::size_t extension_location = filename.rfind(".");
+            if (extension_location == std::string::npos || filename.find('/', extension_location) != std::string::npos)
+                return std::string();
+            return stringformat::StringToLower(filename.substr(extension_location));
+        }
+
+        bool IsDirectory(const std::string &path)
+        {
+            struct stat path_stat;
+            return stat(path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+        }
+
+        // a stream URL or an existing file may contain wildcard characters, such as "[0]" or "?token".
+        bool IsGlobPattern(const std::string &source)
+        {
+            struct stat path_stat;
+            return source.find_first_of("*?[") != std::string::npos && source.find("://") == std::string::npos &&
+                   stat(source.c_str(), &path_stat) != 0;
+        }
+    }
+
+    bool ImageManifest::IsManifest(const std::string &source)
+    {
+        const std::string extension = Extension(source);
+        return extension == ".xml" || extension == ".yml" || extension == ".yaml" || extension == ".json" ||
+               extension == ".txt" || extension == ".lst" || IsGlobPattern(source) || IsDirectory(source);
+    }
+
+    bool ImageManifest::Open(const std::string &source, const std::string &base_path)
+    {
+        text_.close();
+        storage_.release();
+        directory_entries_.clear();
+        has_pending_entry_ = false;
+        source_ = source;
+        base_path_ = base_path;
+        position_ = 0;
+        count_ = -1;
+        kind_ = NO_SOURCE;
+        const std::string extension = Extension(source);
+
+        if (extension == ".txt" || extension == ".lst")
+        {
+            text_.open(source.c_str());
+            if (!text_.is_open())
+                return false;
+            kind_ = TEXT_LIST;
+            ReadTextEntry();
+            return true;
+        }
+
+        if (IsGlobPattern(source) || IsDirectory(source))
+        {
+            // the names are listed without touching the files, and sorted for a stable frame order.
+            std::string directory = source, pattern = "*";
+            if (IsGlobPattern(source))
+            {
+                std::size_t slash = source.rfind('/');
+                directory = slash == std::string::npos ? "." : source.substr(0, slash);
+                pattern = slash == std::string::npos ? source : source.substr(slash + 1);
+            }
+            DIR *dir = opendir(directory.c_str());
+            if (!dir)
+                return false;
+            for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+            {
+                if (entry->d_name[0] == '.' || fnmatch(pattern.c_str(), entry->d_name, 0) != 0)
+                    continue;
+                directory_entries_.push_back(entry->d_name);
+            }
+            closedir(dir);
+            std::sort(directory_entries_.begin(), directory_entries_.end());
+            base_path_ = directory.back() == '/' ? directory : directory + "/";
+            count_ = (int)directory_entries_.size();
+            kind_ = DIRECTORY;
+            return true;
+        }
+
+        // the OpenCV lists are parsed by FileStorage, the names are then read in place from the node.
+        if (!storage_.open(source, cv::FileStorage::READ))
+            return false;
+        storage_list_ = storage_.getFirstTopLevelNode();
+        if (storage_list_.type() != cv::FileNode::SEQ)
+            return false;
+        count_ = (int)storage_list_.size();
+        kind_ = STORAGE_LIST;
+        return true;
+    }
+
+    bool ImageManifest::ReadTextEntry()
+    {
+        has_pending_entry_ = false;
+        while (std::getline(text_, pending_entry_))
+        {
+            // trailing carriage returns and blanks of lists written on other systems.
+            const std::size_t end = pending_entry_.find_last_not_of(" \t\r");
+            pending_entry_.erase(end == std::string::npos ? 0 : end + 1);
+            const std::size_t begin = pending_entry_.find_first_not_of(" \t");
+            if (begin == std::string::npos || pending_entry_[begin] == '#')
+                continue;
+            pending_entry_.erase(0, begin);
+            has_pending_entry_ = true;
+            break;
+        }
+        return has_pending_entry_;
+    }
+
+    bool ImageManifest::HasNext() const
+    {
+        switch (kind_)
+        {
+        case TEXT_LIST:
+            return has_pending_entry_;
+        case STORAGE_LIST:
+        case DIRECTORY:
+            return position_ < count_;
+        default:
+            return false;
+        }
+    }
+
+    bool ImageManifest::Next(std::string &name, std::string &path)
+    {
+        if (!HasNext())
+            return false;
+        switch (kind_)
+        {
+        case TEXT_LIST:
+            name.swap(pending_entry_);
+            ReadTextEntry();
+            break;
+        case STORAGE_LIST:
+            name = (std::string)storage_list_[position_];
+            break;
+        default:
+            name = directory_entries_[position_];
+            break;
+        }
+        position_++;
+        path.reserve(base_path_.size() + name.size());
+        path.assign(base_path_).append(name);
+        return true;
+    }
+
+    bool ImageManifest::Seek(int index)
+    {
+        if (index < 0 || (kind_ != TEXT_LIST && index > count_))
+            return false;
+        if (kind_ == TEXT_LIST)
+        {
+            text_.clear();
+            text_.seekg(0);
+            position_ = 0;
+            ReadTextEntry();
+            for (; position_ < index && has_pending_entry_; position_++)
+                ReadTextEntry();
+            return position_ == index;
+        }
+        position_ = index;
+        return true;
+    }
+
+    int ImageManifest::Count() const
+    {
+        if (count_ >= 0 || kind_ != TEXT_LIST)
+            return std::max(count_, 0);
+
+        // a separate pass over the file, the streaming position is untouched.
+        std::ifstream text(source_.c_str());
+        std::string line;
+        count_ = 0;
+        while (std::getline(text, line))
+        {
+            const std::size_t begin = line.find_first_not_of(" \t\r");
+            if (begin != std::string::npos && line[begin] != '#')
+                count_++;
+        }
+        return count_;
+    }
+}
@@ -2,6 +2,9 @@
 #include <iostream>
 
 #include "calibration/intrinsic_calibration.h"
+#include "calibration/camera_models.h"
+#include "calibration/kb_inverse_model.h"
+#include "calibration/view_selection.h"
 
 namespace fishcat
 {
@@ -14,8 +17,7 @@ namespace fishcat
                   << std::endl;
     }
 
-    double ComputeReprojectionErrors(const std::vector<std::vector<cv::Point3f>> &object_points,
-                                     const std::vector<std::vector<cv::Point2f>> &image_points,
+    double ComputeReprojectionErrors(const ObservationStore &observations,
                                      const std::vector<cv::Mat> &rvecs, const std::vector<cv::Mat> &tvecs,
                                      const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs,
                                      std::vector<float> &perViewErrors,
@@ -25,29 +27,46 @@ namespace fishcat
         std::vector<cv::Point2f> imagePoints2;
         int i, totalPoints = 0;
         double totalErr = 0, err;
-        perViewErrors.resize(object_points.size());
+        perViewErrors.resize(observations.ViewCount());
         std::vector<double> reproj_error_single_vector;
 
-        for (i = 0; i < (int)object_points.size(); ++i)
-        {
-
-            cv::projectPoints(cv::Mat(object_points[i]), rvecs[i], tvecs[i], camera_matrix,
-                              dist_coeffs, imagePoints2);
+        // the fisheye errors are evaluated with the KB model the calibration estimated, only its forward
+        // projection is used, so the inverse is left unfitted with an unbounded FOV.
+        KBInverseModel unbounded_inverse;
+        unbounded_inverse.max_theta = CV_PI;
+        unbounded_inverse.max_radius = unbounded_inverse.max_error = 0;
 
-            for (int j = 0; j < image_points[i].size(); j++)
+        for (i = 0; i < observations.ViewCount(); ++i)
+        {
+            const int n = observations.ViewSize(i);
+            const cv::Point2f *image_points = observations.ViewPoints(i);
+            if (use_fisheye)
+            {
+                err = std::sqrt(ReprojectionErrors(KannalaBrandtModel(camera_matrix, dist_coeffs, unbounded_inverse),
+                                                   observations.ViewObjectPoints(i), image_points, n,
+                                                   rvecs[i], tvecs[i], reproj_error_single_vector));
+                for (int j = 0; j < (int)reproj_error_single_vector.size(); j++)
+                    reproj_error_single_vector[j] = std::sqrt(reproj_error_single_vector[j]);
+            }
+            else
             {
-                reproj_error_single_vector.push_back(std::sqrt((image_points[i][j].x - imagePoints2[j].x) *
-                                                                   (image_points[i][j].x - imagePoints2[j].x) +
-                                                               (image_points[i][j].y - imagePoints2[j].y) *
-                                                                   (image_points[i][j].y - imagePoints2[j].y)));
+                cv::projectPoints(cv::Mat(n, 1, CV_32FC3, (void *)observations.ViewObjectPoints(i)), rvecs[i], tvecs[i],
+                                  camera_matrix, dist_coeffs, imagePoints2);
+
+                for (int j = 0; j < n; j++)
+                {
+                    reproj_error_single_vector.push_back(std::sqrt((image_points[j].x - imagePoints2[j].x) *
+                                                                       (image_points[j].x - imagePoints2[j].x) +
+                                                                   (image_points[j].y - imagePoints2[j].y) *
+                                                                       (image_points[j].y - imagePoints2[j].y)));
+                }
+
+                err = norm(cv::Mat(n, 1, CV_32FC2, (void *)image_points), cv::Mat(imagePoints2), cv::NORM_L2);
             }
 
             reproj_error_single.push_back(reproj_error_single_vector);
             reproj_error_single_vector.clear();
 
-            err = norm(cv::Mat(image_points[i]), cv::Mat(imagePoints2), cv::NORM_L2);
-
-            int n = (int)object_points[i].size();
             perViewErrors[i] = (float)std::sqrt(err * err / n);
             totalErr += err * err;
             totalPoints += n;
@@ -57,38 +76,41 @@ namespace fishcat
     }
 
     bool RunCalibration(CalibrationSettings &s, cv::Size &image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs,
-                        std::vector<std::vector<cv::Point2f>> image_points,
-                        std::vector<std::vector<cv::Point3f>> object_points,
+                        const ObservationStore &observations,
                         std::vector<cv::Mat> &rvecs, std::vector<cv::Mat> &tvecs,
                         std::vector<float> &reproj_errs, double &avg_err)
     {
         std::vector<std::vector<double>> reproj_err_single;
-        int total_number = 0;
-        for (int index = 0; index < object_points.size(); index++)
-        {
-            total_number += object_points[index].size();
-        }
 
-        camera_matrix = cv::Mat::eye(3, 3, CV_64F);
-        if (s.flag_)
-            camera_matrix.at<double>(0, 0) = 1.0;
+        // the solvers read the points in place through Mat headers over the store.
+        std::vector<cv::Mat> image_points, object_points;
+        observations.ImagePointArrays(image_points);
+        observations.ObjectPointArrays(object_points);
+
+        // keep the given intrinsics as the initial guess of a warm started pass.
+        if (!(s.flag_ & cv::CALIB_USE_INTRINSIC_GUESS))
+        {
+            camera_matrix = cv::Mat::eye(3, 3, CV_64F);
+            if (s.flag_)
+                camera_matrix.at<double>(0, 0) = 1.0;
 
-        dist_coeffs = cv::Mat::zeros(4, 1, CV_64F);
+            dist_coeffs = cv::Mat::zeros(4, 1, CV_64F);
+        }
 
         // Find intrinsic and extrinsic camera parameters
         double rms;
         if (s.use_fisheye_model_)
         {
             rms = cv::fisheye::calibrate(object_points, image_points, image_size, camera_matrix, dist_coeffs, rvecs, tvecs, s.flag_);
-            avg_err = ComputeReprojectionErrors(object_points, image_points,
+            avg_err = ComputeReprojectionErrors(observations,
                                                 rvecs, tvecs, camera_matrix, dist_coeffs,
-                                                reproj_errs, reproj_err_single);
+                                                reproj_errs, reproj_err_single, true);
         }
         else
         {
             rms = cv::calibrateCamera(object_points, image_points, image_size, camera_matrix,
                                       dist_coeffs, rvecs, tvecs, s.flag_ | cv::CALIB_FIX_K4 | cv::CALIB_FIX_K5);
-            avg_err = ComputeReprojectionErrors(object_points, image_points,
+            avg_err = ComputeReprojectionErrors(observations,
                                                 rvecs, tvecs, camera_matrix, dist_coeffs,
                                                 reproj_errs, reproj_err_single);
         }
@@ -102,29 +124,74 @@ namespace fishcat
         return ok;
     }
 
-    bool RunCalibrationAndSave(CalibrationSettings &s, cv::Size image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs, std::vector<std::vector<cv::Point2f>> image_points, std::vector<std::vector<cv::Point3f>> object_points)
+    bool RunCalibrationAndSave(CalibrationSettings &s, cv::Size image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs,
+                               const ObservationStore &observations,
+                               const std::vector<VignettingSample> &vignetting_samples)
     {
         std::vector<cv::Mat> rvecs, tvecs;
         std::vector<float> reproj_errs;
         double total_avg_err = 0;
 
-        bool ok = RunCalibration(s, image_size, camera_matrix, dist_coeffs,
-                                 image_points, object_points,
-                                 rvecs, tvecs,
-                                 reproj_errs, total_avg_err);
+        // the saved points must match the saved extrinsics.
+        const ObservationStore *saved_observations = &observations;
+        ObservationStore selected_observations;
+
+        bool ok;
+        if (s.bview_selection_)
+        {
+            std::vector<int> selected_views = SelectCalibrationViews(image_size, observations,
+                                                                     s.view_selection_max_views_);
+            FitViewsToTimeBudget(s, image_size, observations,
+                                 s.view_selection_time_budget_, selected_views);
+
+            selected_observations = observations.Subset(selected_views);
+            ok = RunCalibration(s, image_size, camera_matrix, dist_coeffs,
+                                selected_observations,
+                                rvecs, tvecs,
+                                reproj_errs, total_avg_err);
+
+            if (ok && s.bview_selection_refine_)
+            {
+                LOG(INFO) << "Refining the selected-view calibration with all the " << observations.ViewCount() << " views."
+                          << std::endl;
+                const int flag = s.flag_;
+                s.flag_ |= s.use_fisheye_model_ ? (int)cv::fisheye::CALIB_USE_INTRINSIC_GUESS : (int)cv::CALIB_USE_INTRINSIC_GUESS;
+                ok = RunCalibration(s, image_size, camera_matrix, dist_coeffs,
+                                    observations,
+                                    rvecs, tvecs,
+                                    reproj_errs, total_avg_err);
+                s.flag_ = flag;
+            }
+            else
+            {
+                saved_observations = &selected_observations;
+            }
+        }
+        else
+        {
+            ok = RunCalibration(s, image_size, camera_matrix, dist_coeffs,
+                                observations,
+                                rvecs, tvecs,
+                                reproj_errs, total_avg_err);
+        }
         LOG(INFO) << (ok ? "Calibration succeeded" : "Calibration failed");
 
+        // the falloff is fitted against theta, so it needs the calibrated intrinsics.
+        VignettingModel vignetting;
+        if (ok && s.bcalibrate_vignetting_)
+            vignetting = FitVignettingModel(vignetting_samples, camera_matrix, dist_coeffs, image_size);
+
         if (ok)
             SaveIntrinsicCameraParams(s, image_size, camera_matrix, dist_coeffs, rvecs, tvecs, reproj_errs,
-                                      image_points, total_avg_err);
+                                      *saved_observations, total_avg_err, vignetting);
         return ok;
     }
 
     // Print camera parameters to the output file
     void SaveIntrinsicCameraParams(CalibrationSettings &s, cv::Size &image_size, cv::Mat &camera_matrix, cv::Mat &dist_coeffs,
                                    const std::vector<cv::Mat> &rvecs, const std::vector<cv::Mat> &tvecs,
-                                   const std::vector<float> &reproj_errs, const std::vector<std::vector<cv::Point2f>> &image_points,
-                                   double total_avg_err)
+                                   const std::vector<float> &reproj_errs, const ObservationStore &observations,
+                                   double total_avg_err, const VignettingModel &vignetting)
     {
         cv::FileStorage fs(s.output_fileName_, cv::FileStorage::WRITE);
 
@@ -158,10 +225,18 @@ namespace fishcat
         }
 
         fs << "flagValue" << s.flag_;
+        // the registry import reads the lens type of the coefficients from it.
+        fs << "Camera_Model" << CameraModelName(s.use_fisheye_model_ ? KANNALA_BRANDT : PINHOLE);
 
         fs << "Camera_Matrix" << camera_matrix;
         fs << "Distortion_Coefficients" << dist_coeffs;
 
+        // the inverse polynomial gives fixed-cost unprojection to the applications.
+        if (s.use_fisheye_model_)
+            WriteKBInverseModel(fs, FitKBInverseModel(camera_matrix, dist_coeffs, image_size));
+        if (!vignetting.coefficients.empty())
+            WriteVignettingModel(fs, vignetting);
+
         fs << "Avg_Reprojection_Error" << total_avg_err;
         if (!reproj_errs.empty())
             fs << "Per_View_Reprojection_Errors" << cv::Mat(reproj_errs);
@@ -185,16 +260,21 @@ namespace fishcat
             fs << "Extrinsic_Parameters" << bigmat;
         }
 
-        if (!image_points.empty())
+        if (observations.ViewCount() > 0 && observations.AllComplete())
         {
-            cv::Mat imagePtMat((int)image_points.size(), (int)image_points[0].size(), CV_32FC2);
-            for (int i = 0; i < (int)image_points.size(); i++)
-            {
-                cv::Mat r = imagePtMat.row(i).reshape(2, imagePtMat.cols);
-                cv::Mat imgpti(image_points[i]);
-                imgpti.copyTo(r);
-            }
+            // one row per view, read straight from the contiguous corner array.
+            cv::Mat imagePtMat(observations.ViewCount(), observations.ViewSize(0), CV_32FC2,
+                               (void *)observations.ViewPoints(0));
             fs << "Image_points" << imagePtMat;
         }
+        else if (observations.ViewCount() > 0)
+        {
+            // partial boards have a different number of points per view, save them flattened.
+            std::vector<int> view_sizes;
+            for (int i = 0; i < observations.ViewCount(); i++)
+                view_sizes.push_back(observations.ViewSize(i));
+            fs << "Image_points" << cv::Mat(observations.PointCount(), 1, CV_32FC2, (void *)observations.ViewPoints(0));
+            fs << "Image_points_per_view" << cv::Mat(view_sizes);
+        }
     }
 } // namespace fishcat
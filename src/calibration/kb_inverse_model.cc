@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cmath>
+
+#include "base/log.h"
+#include "calibration/kb_inverse_model.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const int kFitSamples = 1000;
+        const int kValidationSamples = 10000;
+        const int kMinTerms = 3;
+        const int kMaxTerms = 10;
+
+        double KBDistortDerivative(double theta, const cv::Mat &distortion_coefficient)
+        {
+            const double k1 = distortion_coefficient.at<double>(0), k2 = distortion_coefficient.at<double>(1);
+            const double k3 = distortion_coefficient.at<double>(2), k4 = distortion_coefficient.at<double>(3);
+            double theta2 = theta * theta;
+            return 1 + theta2 * (3 * k1 + theta2 * (5 * k2 + theta2 * (7 * k3 + theta2 * 9 * k4)));
+        }
+
+        // the polynomial is only invertible while r_d grows with theta.
+        double MonotonicThetaLimit(const cv::Mat &distortion_coefficient, double theta_limit)
+        {
+            const int steps = 1000;
+            for (int i = 1; i <= steps; i++)
+            {
+                double theta = theta_limit * i / steps;
+                if (KBDistortDerivative(theta, distortion_coefficient) <= 0)
+                    return theta_limit * (i - 1) / steps;
+            }
+            return theta_limit;
+        }
+    }
+
+    double KBDistortTheta(double theta, const cv::Mat &distortion_coefficient)
+    {
+        const double k1 = distortion_coefficient.at<double>(0), k2 = distortion_coefficient.at<double>(1);
+        const double k3 = distortion_coefficient.at<double>(2), k4 = distortion_coefficient.at<double>(3);
+        double theta2 = theta * theta;
+        return theta * (1 + theta2 * (k1 + theta2 * (k2 + theta2 * (k3 + theta2 * k4))));
+    }
+
+    KBInverseModel FitKBInverseModel(const cv::Mat &distortion_coefficient, double max_theta,
+                                     double max_error_tolerance)
+    {
+        KBInverseModel inverse_model;
+        inverse_model.max_theta = std::min(max_theta, MonotonicThetaLimit(distortion_coefficient, CV_PI));
+        inverse_model.max_radius = KBDistortTheta(inverse_model.max_theta, distortion_coefficient);
+        inverse_model.max_error = 0;
+
+        std::vector<double> normalized_radius(kFitSamples), thetas(kFitSamples);
+        for (int i = 0; i < kFitSamples; i++)
+        {
+            thetas[i] = inverse_model.max_theta * i / (kFitSamples - 1);
+            normalized_radius[i] = KBDistortTheta(thetas[i], distortion_coefficient) / inverse_model.max_radius;
+        }
+
+        for (int terms = kMinTerms; terms <= kMaxTerms; terms++)
+        {
+            cv::Mat A(kFitSamples, terms, CV_64F), b(kFitSamples, 1, CV_64F), x;
+            for (int i = 0; i < kFitSamples; i++)
+            {
+                double s = normalized_radius[i], s2 = s * s, power = s;
+                for (int k = 0; k < terms; k++, power *= s2)
+                    A.at<double>(i, k) = power;
+                b.at<double>(i, 0) = thetas[i];
+            }
+            cv::solve(A, b, x, cv::DECOMP_SVD);
+
+            inverse_model.coefficients.assign(x.ptr<double>(), x.ptr<double>() + terms);
+            inverse_model.max_error = ValidateKBInverseModel(inverse_model, distortion_coefficient);
+            if (inverse_model.max_error <= max_error_tolerance)
+                break;
+        }
+
+        LOG(INFO) << "Inverse KB polynomial of " << inverse_model.coefficients.size()
+                  << " terms up to theta " << inverse_model.max_theta * 180 / CV_PI
+                  << " deg, max angular error " << inverse_model.max_error * 180 / CV_PI << " deg."
+                  << std::endl;
+        return inverse_model;
+    }
+
+    KBInverseModel FitKBInverseModel(const cv::Mat &intrinsic, const cv::Mat &distortion_coefficient,
+                                     const cv::Size &image_size, double max_error_tolerance)
+    {
+        const double fx = intrinsic.at<double>(0, 0), fy = intrinsic.at<double>(1, 1);
+        const double cx = intrinsic.at<double>(0, 2), cy = intrinsic.at<double>(1, 2);
+        double max_radius = 0;
+        const double corners[4][2] = {{0, 0}, {(double)image_size.width, 0}, {0, (double)image_size.height}, {(double)image_size.width, (double)image_size.height}};
+        for (const auto &corner : corners)
+        {
+            double x_d = (corner[0] - cx) / fx, y_d = (corner[1] - cy) / fy;
+            max_radius = std::max(max_radius, std::sqrt(x_d * x_d + y_d * y_d));
+        }
+
+        // bisection of the forward model, run once per camera.
+        double low = 0, high = MonotonicThetaLimit(distortion_coefficient, CV_PI);
+        if (KBDistortTheta(high, distortion_coefficient) > max_radius)
+        {
+            for (int iteration = 0; iteration < 60; iteration++)
+            {
+                double middle = 0.5 * (low + high);
+                if (KBDistortTheta(middle, distortion_coefficient) < max_radius)
+                    low = middle;
+                else
+                    high = middle;
+            }
+        }
+
+        return FitKBInverseModel(distortion_coefficient, high, max_error_tolerance);
+    }
+
+    double ValidateKBInverseModel(const KBInverseModel &inverse_model, const cv::Mat &distortion_coefficient)
+    {
+        double max_error = 0;
+        for (int i = 0; i < kValidationSamples; i++)
+        {
+            double theta = inverse_model.max_theta * i / (kValidationSamples - 1);
+            double error = std::abs(inverse_model.Theta(KBDistortTheta(theta, distortion_coefficient)) - theta);
+            max_error = std::max(max_error, error);
+        }
+        return max_error;
+    }
+
+    void WriteKBInverseModel(cv::FileStorage &fs, const KBInverseModel &inverse_model)
+    {
+        fs << "Inverse_Distortion_Coefficients" << cv::Mat(inverse_model.coefficients);
+        fs << "Inverse_Max_Theta" << inverse_model.max_theta;
+        fs << "Inverse_Max_Radius" << inverse_model.max_radius;
+        fs << "Inverse_Max_Error" << inverse_model.max_error;
+    }
+
+    bool ReadKBInverseModel(const cv::FileStorage &fs, KBInverseModel &inverse_model)
+    {
+        return ReadKBInverseModel(fs.root(), inverse_model);
+    }
+
+    bool ReadKBInverseModel(const cv::FileNode &node, KBInverseModel &inverse_model)
+    {
+        cv::Mat coefficients;
+        node["Inverse_Distortion_Coefficients"] >> coefficients;
+        if (coefficients.empty())
+            return false;
+
+        coefficients.convertTo(coefficients, CV_64F);
+        inverse_model.coefficients.assign(coefficients.ptr<double>(), coefficients.ptr<double>() + coefficients.total());
+        node["Inverse_Max_Theta"] >> inverse_model.max_theta;
+        node["Inverse_Max_Radius"] >> inverse_model.max_radius;
+        node["Inverse_Max_Error"] >> inverse_model.max_error;
+        return inverse_model.max_radius > 0;
+    }
+}
@@ -0,0 +1,74 @@
+#include "calibration/observation_store.h"
+
+namespace fishcat
+{
+    ObservationStore::ObservationStore(const std::vector<cv::Point3f> &board_points)
+        : board_points_(board_points), view_offsets_(1, 0)
+    {
+    }
+
+    void ObservationStore::Reserve(int views, int points)
+    {
+        points_.reserve(points);
+        point_ids_.reserve(points);
+        view_offsets_.reserve(views + 1);
+        object_offsets_.reserve(views);
+    }
+
+    void ObservationStore::AddView(const std::vector<cv::Point2f> &points, const std::vector<int> &point_ids)
+    {
+        CV_Assert(points.size() == point_ids.size());
+        AppendView(points.data(), point_ids.data(), (int)points.size());
+    }
+
+    void ObservationStore::AppendView(const cv::Point2f *points, const int *point_ids, int count)
+    {
+        points_.insert(points_.end(), points, points + count);
+        point_ids_.insert(point_ids_.end(), point_ids, point_ids + count);
+        view_offsets_.push_back((int)points_.size());
+
+        // the views holding every board point in order use the board array itself.
+        bool complete = count == (int)board_points_.size();
+        for (int i = 0; complete && i < count; i++)
+            complete = point_ids[i] == i;
+        if (complete)
+        {
+            object_offsets_.push_back(-1);
+            return;
+        }
+
+        object_offsets_.push_back((int)partial_object_points_.size());
+        for (int i = 0; i < count; i++)
+            partial_object_points_.push_back(board_points_[point_ids[i]]);
+    }
+
+    ObservationStore ObservationStore::Subset(const std::vector<int> &views) const
+    {
+        ObservationStore subset(board_points_);
+        int points = 0, partial_points = 0;
+        for (int view : views)
+        {
+            points += ViewSize(view);
+            partial_points += IsComplete(view) ? 0 : ViewSize(view);
+        }
+        subset.Reserve((int)views.size(), points);
+        subset.partial_object_points_.reserve(partial_points);
+        for (int view : views)
+            subset.AppendView(ViewPoints(view), ViewIds(view), ViewSize(view));
+        return subset;
+    }
+
+    void ObservationStore::ImagePointArrays(std::vector<cv::Mat> &arrays) const
+    {
+        arrays.resize(ViewCount());
+        for (int view = 0; view < ViewCount(); view++)
+            arrays[view] = cv::Mat(ViewSize(view), 1, CV_32FC2, (void *)ViewPoints(view));
+    }
+
+    void ObservationStore::ObjectPointArrays(std::vector<cv::Mat> &arrays) const
+    {
+        arrays.resize(ViewCount());
+        for (int view = 0; view < ViewCount(); view++)
+            arrays[view] = cv::Mat(ViewSize(view), 1, CV_32FC3, (void *)ViewObjectPoints(view));
+    }
+}
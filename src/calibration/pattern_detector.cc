@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include <opencv2/opencv_modules.hpp>
+#ifdef HAVE_OPENCV_ARUCO
+#include <opencv2/aruco/charuco.hpp>
+#endif
+
+#include "base/log.h"
+#include "calibration/pattern_detector.h"
+#include "calibration/saddle_refiner.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const int kMaxDetectionSide = 2000; // circle grids are searched below this resolution.
+
+        // Saddle refinement of chessboard corners, the corners without a saddle in their window
+        // fall back to a small cornerSubPix window.
+        void RefineChessboardCorners(const cv::Mat &gray, const cv::Size &grid_size, const std::vector<int> &point_ids,
+                                     std::vector<cv::Point2f> &points, std::vector<float> *confidences)
+        {
+            std::vector<float> point_confidences;
+            RefineSaddlePoints(gray, grid_size, point_ids, points, point_confidences);
+            std::vector<cv::Point2f> failed_points;
+            std::vector<int> failed_indices;
+            for (int i = 0; i < (int)points.size(); i++)
+            {
+                if (point_confidences[i] > 0)
+                    continue;
+                failed_points.push_back(points[i]);
+                failed_indices.push_back(i);
+            }
+            if (!failed_points.empty())
+            {
+                cv::cornerSubPix(gray, failed_points, cv::Size(5, 5),
+                                 cv::Size(-1, -1), cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 10, 0.05));
+                for (int i = 0; i < (int)failed_indices.size(); i++)
+                    points[failed_indices[i]] = failed_points[i];
+            }
+            if (confidences)
+                confidences->swap(point_confidences);
+        }
+    }
+
+    void PatternDetector::RefinePoints(const cv::Mat &gray, std::vector<cv::Point2f> &points,
+                                       std::vector<float> *confidences) const
+    {
+        // the prediction is within a pixel or two, a small window is enough.
+        cv::cornerSubPix(gray, points, cv::Size(5, 5),
+                         cv::Size(-1, -1), cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 10, 0.05));
+        if (confidences)
+            confidences->clear();
+    }
+
+    ChessboardDetector::ChessboardDetector(const cv::Size &board_size, float square_size, bool saddle_refine)
+        : board_size_(board_size), saddle_refine_(saddle_refine)
+    {
+        for (int i = 0; i < board_size.height; ++i)
+            for (int j = 0; j < board_size.width; ++j)
+                board_points_.push_back(cv::Point3f(j * square_size, i * square_size, 0));
+    }
+
+    bool ChessboardDetector::Detect(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                                    std::vector<float> *confidences)
+    {
+        int chessboard_flags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE | cv::CALIB_CB_FAST_CHECK;
+        if (!cv::findChessboardCorners(gray, board_size_, points, chessboard_flags))
+            return false;
+
+        point_ids.resize(points.size());
+        std::iota(point_ids.begin(), point_ids.end(), 0);
+        if (saddle_refine_)
+        {
+            RefineChessboardCorners(gray, board_size_, point_ids, points, confidences);
+        }
+        else
+        {
+            cv::cornerSubPix(gray, points, cv::Size(11, 11),
+                             cv::Size(-1, -1), cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.1));
+            if (confidences)
+                confidences->clear();
+        }
+        return true;
+    }
+
+    void ChessboardDetector::RefinePoints(const cv::Mat &gray, std::vector<cv::Point2f> &points,
+                                          std::vector<float> *confidences) const
+    {
+        if (!saddle_refine_ || (int)points.size() != board_size_.area())
+        {
+            PatternDetector::RefinePoints(gray, points, confidences);
+            return;
+        }
+        std::vector<int> point_ids(points.size());
+        std::iota(point_ids.begin(), point_ids.end(), 0);
+        RefineChessboardCorners(gray, board_size_, point_ids, points, confidences);
+    }
+
+    CirclesGridDetector::CirclesGridDetector(const cv::Size &board_size, float square_size, bool asymmetric)
+        : board_size_(board_size), asymmetric_(asymmetric)
+    {
+        for (int i = 0; i < board_size.height; ++i)
+            for (int j = 0; j < board_size.width; ++j)
+                board_points_.push_back(asymmetric ? cv::Point3f((2 * j + i % 2) * square_size, i * square_size, 0)
+                                                   : cv::Point3f(j * square_size, i * square_size, 0));
+    }
+
+    bool CirclesGridDetector::Detect(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                                     std::vector<float> *confidences)
+    {
+        // the blob detector dominates the cost, so search on a reduced pyramid level.
+        cv::Mat reduced = gray;
+        int scale = 1;
+        while (std::max(reduced.cols, reduced.rows) > kMaxDetectionSide)
+        {
+            cv::Mat next;
+            cv::pyrDown(reduced, next);
+            reduced = next;
+            scale *= 2;
+        }
+
+        if (confidences)
+            confidences->clear();
+        int grid_flags = asymmetric_ ? cv::CALIB_CB_ASYMMETRIC_GRID : cv::CALIB_CB_SYMMETRIC_GRID;
+        if (!cv::findCirclesGrid(reduced, board_size_, points, grid_flags))
+            return false;
+
+        if (scale > 1)
+        {
+            // pyrDown maps the pixel center x to (x + 0.5) / 2 - 0.5.
+            for (cv::Point2f &point : points)
+            {
+                point.x = (point.x + 0.5f) * scale - 0.5f;
+                point.y = (point.y + 0.5f) * scale - 0.5f;
+            }
+            RefinePoints(gray, points);
+        }
+
+        point_ids.resize(points.size());
+        std::iota(point_ids.begin(), point_ids.end(), 0);
+        return true;
+    }
+
+    void CirclesGridDetector::RefinePoints(const cv::Mat &gray, std::vector<cv::Point2f> &points,
+                                           std::vector<float> *confidences) const
+    {
+        if (confidences)
+            confidences->clear();
+        const int columns = board_size_.width;
+
+#pragma omp parallel for
+        for (int index = 0; index < (int)points.size(); index++)
+        {
+            // the window stays inside the circle, taken from the closest grid neighbor.
+            double spacing = std::numeric_limits<double>::max();
+            const int neighbors[4] = {index - 1, index + 1, index - columns, index + columns};
+            for (int neighbor : neighbors)
+                if (neighbor >= 0 && neighbor < (int)points.size())
+                    spacing = std::min(spacing, (double)cv::norm(points[neighbor] - points[index]));
+            int radius = std::max(2, (int)(0.3 * spacing));
+
+            cv::Rect window(cvRound(points[index].x) - radius, cvRound(points[index].y) - radius,
+                            2 * radius + 1, 2 * radius + 1);
+            window &= cv::Rect(0, 0, gray.cols, gray.rows);
+            if (window.area() == 0)
+                continue;
+
+            // dark circles on a white board, weight the pixels by their darkness.
+            cv::Mat patch = gray(window);
+            double min_value, max_value;
+            cv::minMaxLoc(patch, &min_value, &max_value);
+            double sum_weight = 0, sum_x = 0, sum_y = 0;
+            for (int y = 0; y < patch.rows; y++)
+            {
+                const uchar *row = patch.ptr<uchar>(y);
+                for (int x = 0; x < patch.cols; x++)
+                {
+                    double weight = max_value - row[x];
+                    sum_weight += weight;
+                    sum_x += weight * x;
+                    sum_y += weight * y;
+                }
+            }
+            if (sum_weight > 0)
+                points[index] = cv::Point2f((float)(window.x + sum_x / sum_weight), (float)(window.y + sum_y / sum_weight));
+        }
+    }
+
+#ifdef HAVE_OPENCV_ARUCO
+    struct CharucoDetector::Impl
+    {
+        cv::Ptr<cv::aruco::Dictionary> dictionary;
+        cv::Ptr<cv::aruco::CharucoBoard> board;
+        cv::Ptr<cv::aruco::DetectorParameters> parameters;
+    };
+#else
+    struct CharucoDetector::Impl
+    {
+    };
+#endif
+
+    CharucoDetector::CharucoDetector(const cv::Size &board_size, float square_size, float marker_size,
+                                     int dictionary_id, bool allow_partial, bool saddle_refine)
+        : impl_(std::make_shared<Impl>()), corner_grid_(board_size.width - 1, board_size.height - 1),
+          allow_partial_(allow_partial), saddle_refine_(saddle_refine)
+    {
+#ifdef HAVE_OPENCV_ARUCO
+        impl_->dictionary = cv::aruco::getPredefinedDictionary(dictionary_id);
+        impl_->board = cv::aruco::CharucoBoard::create(board_size.width, board_size.height,
+                                                       square_size, marker_size, impl_->dictionary);
+        impl_->parameters = cv::aruco::DetectorParameters::create();
+        board_points_ = impl_->board->chessboardCorners;
+#endif
+        // partial views need enough corners for the initial homography of the solvers.
+        min_points_ = allow_partial_ ? 6 : (int)board_points_.size();
+    }
+
+    bool CharucoDetector::Detect(const cv::Mat &gray, std::vector<cv::Point2f> &points, std::vector<int> &point_ids,
+                                 std::vector<float> *confidences)
+    {
+#ifdef HAVE_OPENCV_ARUCO
+        std::vector<std::vector<cv::Point2f>> marker_corners;
+        std::vector<int> marker_ids;
+        cv::aruco::detectMarkers(gray, impl_->dictionary, marker_corners, marker_ids, impl_->parameters);
+        if (marker_ids.empty())
+            return false;
+
+        // the chessboard corners between the found markers are refined at subpixel level.
+        cv::aruco::interpolateCornersCharuco(marker_corners, marker_ids, gray, impl_->board, points, point_ids);
+        if (saddle_refine_ && !points.empty())
+            RefineChessboardCorners(gray, corner_grid_, point_ids, points, confidences);
+        else if (confidences)
+            confidences->clear();
+        return (int)point_ids.size() >= std::max(min_points_, 4);
+#else
+        return false;
+#endif
+    }
+
+    std::unique_ptr<PatternDetector> CreatePatternDetector(const CalibrationSettings &s)
+    {
+        switch (s.calibration_pattern_)
+        {
+        case CalibrationSettings::CHESSBOARD:
+            return std::unique_ptr<PatternDetector>(new ChessboardDetector(s.board_size_, s.square_size_, s.bsaddle_refiner_));
+        case CalibrationSettings::CIRCLES_GRID:
+            return std::unique_ptr<PatternDetector>(new CirclesGridDetector(s.board_size_, s.square_size_, false));
+        case CalibrationSettings::ASYMMETRIC_CIRCLES_GRID:
+            return std::unique_ptr<PatternDetector>(new CirclesGridDetector(s.board_size_, s.square_size_, true));
+        case CalibrationSettings::CHARUCO:
+#ifdef HAVE_OPENCV_ARUCO
+            return std::unique_ptr<PatternDetector>(new CharucoDetector(s.board_size_, s.square_size_, s.marker_size_,
+                                                                        s.charuco_dictionary_, s.show_partial_board_,
+                                                                        s.bsaddle_refiner_));
+#else
+            LOG(ERROR) << "ChArUco boards need OpenCV built with the aruco contrib module." << std::endl;
+            return nullptr;
+#endif
+        default:
+            return nullptr;
+        }
+    }
+}
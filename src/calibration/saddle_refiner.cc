@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "calibration/saddle_refiner.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const int kMinRadius = 2;
+        const int kMaxRadius = 12;
+        const int kDefaultRadius = 5;      // corners without a grid neighbor, the 11x11 window of cornerSubPix.
+        const double kWindowScale = 0.35;  // of the neighbor spacing, the window stays inside the four squares.
+        const int kMaxIterations = 4;
+        const double kConvergence = 0.01;  // pixels.
+        const double kMinContrast = 2.0;   // gray levels the weaker curvature spans over the window.
+
+        // Linear operator from a raw patch of patch_radius to the coefficients a, b, c, d, e of
+        // I(x, y) = a x^2 + b xy + c y^2 + d x + e y + f on the window of radius. The Gaussian blur
+        // and the weighted least squares are folded into one row per coefficient, so a fit is five
+        // dot products over the patch.
+        struct SaddleKernel
+        {
+            int patch_radius;
+            cv::Mat rows; // 5 x (2 * patch_radius + 1)^2, CV_32F.
+        };
+
+        SaddleKernel BuildSaddleKernel(int radius)
+        {
+            const double blur_sigma = std::max(0.7, 0.5 * radius), weight_sigma = radius;
+            const int blur_radius = (int)std::ceil(2 * blur_sigma);
+            const int side = 2 * radius + 1, count = side * side;
+
+            // weighted least squares of the window, M = (A^T W A)^-1 A^T W.
+            cv::Mat A(count, 6, CV_64F), W(count, 1, CV_64F);
+            for (int y = -radius, i = 0; y <= radius; y++)
+            {
+                for (int x = -radius; x <= radius; x++, i++)
+                {
+                    double *row = A.ptr<double>(i);
+                    row[0] = x * x;
+                    row[1] = x * y;
+                    row[2] = y * y;
+                    row[3] = x;
+                    row[4] = y;
+                    row[5] = 1;
+                    W.at<double>(i) = std::exp(-(x * x + y * y) / (2 * weight_sigma * weight_sigma));
+                }
+            }
+            cv::Mat AtW = A.t();
+            for (int k = 0; k < 6; k++)
+                for (int i = 0; i < count; i++)
+                    AtW.at<double>(k, i) *= W.at<double>(i);
+            const cv::Mat normal = AtW * A;
+            const cv::Mat M = normal.inv(cv::DECOMP_SVD) * AtW;
+
+            // the blur spreads every fit weight over the neighborhood of its pixel.
+            SaddleKernel kernel;
+            kernel.patch_radius = radius + blur_radius;
+            const int patch_side = 2 * kernel.patch_radius + 1;
+            kernel.rows.create(5, patch_side * patch_side, CV_32F);
+            const cv::Mat gaussian = cv::getGaussianKernel(2 * blur_radius + 1, blur_sigma, CV_64F);
+            for (int k = 0; k < 5; k++)
+            {
+                cv::Mat fit_weights = M.row(k).reshape(1, side), padded, blurred;
+                cv::copyMakeBorder(fit_weights, padded, blur_radius, blur_radius, blur_radius, blur_radius,
+                                   cv::BORDER_CONSTANT, cv::Scalar(0));
+                cv::sepFilter2D(padded, blurred, CV_64F, gaussian, gaussian, cv::Point(-1, -1), 0, cv::BORDER_CONSTANT);
+                cv::Mat kernel_row = kernel.rows.row(k);
+                blurred.reshape(1, 1).convertTo(kernel_row, CV_32F);
+            }
+            return kernel;
+        }
+
+        const SaddleKernel &SaddleKernelOfRadius(int radius)
+        {
+            static const std::vector<SaddleKernel> kernels = []()
+            {
+                std::vector<SaddleKernel> all(kMaxRadius + 1);
+                for (int r = kMinRadius; r <= kMaxRadius; r++)
+                    all[r] = BuildSaddleKernel(r);
+                return all;
+            }();
+            return kernels[radius];
+        }
+
+        // Fits the saddle around center, false if the surface is no saddle or its point leaves the window.
+        bool FitSaddle(const cv::Mat &gray, const SaddleKernel &kernel, int radius, cv::Point2f &center,
+                       cv::Mat &patch, float &confidence)
+        {
+            const int patch_side = 2 * kernel.patch_radius + 1;
+            const cv::Point2f start = center;
+            for (int iteration = 0; iteration < kMaxIterations; iteration++)
+            {
+                // bilinear patch centered on the estimate, the border pixels are replicated.
+                cv::getRectSubPix(gray, cv::Size(patch_side, patch_side), center, patch, CV_32F);
+                const cv::Mat samples = patch.reshape(1, 1);
+                const double a = kernel.rows.row(0).dot(samples), b = kernel.rows.row(1).dot(samples),
+                             c = kernel.rows.row(2).dot(samples), d = kernel.rows.row(3).dot(samples),
+                             e = kernel.rows.row(4).dot(samples);
+
+                // the gradient 2a x + b y + d, b x + 2c y + e vanishes at the saddle.
+                const double det = 4 * a * c - b * b;
+                if (det >= 0)
+                    return false;
+                const cv::Point2f offset((float)((b * e - 2 * c * d) / det), (float)((b * d - 2 * a * e) / det));
+                center += offset;
+                if (cv::norm(center - start) > radius)
+                    return false;
+
+                const double root = std::sqrt((a - c) * (a - c) + b * b);
+                const double weak = std::min(std::abs(a + c + root), std::abs(a + c - root));
+                const double strong = std::max(std::abs(a + c + root), std::abs(a + c - root));
+                if (weak * radius * radius < kMinContrast)
+                    return false;
+                confidence = (float)(weak / strong);
+                if (cv::norm(offset) < kConvergence)
+                    break;
+            }
+            return true;
+        }
+    }
+
+    void RefineSaddlePoints(const cv::Mat &gray, const cv::Size &grid_size, const std::vector<int> &point_ids,
+                            std::vector<cv::Point2f> &points, std::vector<float> &confidences)
+    {
+        const int number_points = (int)points.size();
+        std::vector<int> point_of_id(grid_size.area(), -1);
+        for (int i = 0; i < number_points; i++)
+            if (point_ids[i] >= 0 && point_ids[i] < grid_size.area())
+                point_of_id[point_ids[i]] = i;
+
+        // the local board scale is the distance to the closest detected grid neighbor.
+        std::vector<int> radii(number_points, kDefaultRadius);
+        for (int i = 0; i < number_points; i++)
+        {
+            const int id = point_ids[i], column = id % grid_size.width;
+            const int neighbors[4] = {column > 0 ? id - 1 : -1, column + 1 < grid_size.width ? id + 1 : -1,
+                                      id - grid_size.width, id + grid_size.width};
+            double spacing = std::numeric_limits<double>::max();
+            for (int neighbor : neighbors)
+                if (neighbor >= 0 && neighbor < grid_size.area() && point_of_id[neighbor] >= 0)
+                    spacing = std::min(spacing, (double)cv::norm(points[point_of_id[neighbor]] - points[i]));
+            if (spacing < std::numeric_limits<double>::max())
+                radii[i] = std::min(std::max((int)std::lround(kWindowScale * spacing), kMinRadius), kMaxRadius);
+        }
+
+        confidences.assign(number_points, 0.0f);
+#pragma omp parallel
+        {
+            cv::Mat patch; // reused by all the corners of a thread.
+#pragma omp for schedule(dynamic, 16)
+            for (int i = 0; i < number_points; i++)
+            {
+                cv::Point2f center = points[i];
+                float confidence = 0;
+                if (FitSaddle(gray, SaddleKernelOfRadius(radii[i]), radii[i], center, patch, confidence))
+                {
+                    points[i] = center;
+                    confidences[i] = confidence;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cmath>
+
+#include <ceres/ceres.h>
+#include <ceres/rotation.h>
+#include <opencv2/features2d.hpp>
+
+#include "base/log.h"
+#include "calibration/targetless_extrinsics.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const int kRansacRound = 256;        // hypotheses scored in parallel between two stopping checks.
+        const double kConfidence = 0.999;    // probability of drawing one all-inlier pair.
+        const double kMinPairAngle = 0.02;   // radians, closer bearings give an ill-conditioned solve.
+        const int kMinInliers = 10;
+
+        // the orthonormal frame spanned by two bearings, as the columns of the matrix.
+        bool PairFrame(const cv::Vec3d &first, const cv::Vec3d &second, cv::Matx33d &frame)
+        {
+            cv::Vec3d normal = first.cross(second);
+            const double norm = cv::norm(normal);
+            if (norm < std::sin(kMinPairAngle))
+                return false;
+            normal /= norm;
+            const cv::Vec3d third = first.cross(normal);
+            for (int i = 0; i < 3; i++)
+            {
+                frame(i, 0) = first[i];
+                frame(i, 1) = normal[i];
+                frame(i, 2) = third[i];
+            }
+            return true;
+        }
+
+        // rotation taking the left pair onto the right pair, the first bearings are matched exactly.
+        bool SolveTwoPointRotation(const BearingMatch &a, const BearingMatch &b, double inlier_angle, cv::Matx33d &rotation)
+        {
+            // a rotation keeps the angle between the two bearings.
+            const double left_angle = std::acos(std::min(1.0, std::max(-1.0, a.left.dot(b.left))));
+            const double right_angle = std::acos(std::min(1.0, std::max(-1.0, a.right.dot(b.right))));
+            if (std::abs(left_angle - right_angle) > 2 * inlier_angle)
+                return false;
+
+            cv::Matx33d left_frame, right_frame;
+            if (!PairFrame(a.left, b.left, left_frame) || !PairFrame(a.right, b.right, right_frame))
+                return false;
+            rotation = right_frame * left_frame.t();
+            return true;
+        }
+
+        int CountInliers(const std::vector<BearingMatch> &matches, const cv::Matx33d &rotation, double cos_threshold,
+                         std::vector<int> *inliers = nullptr)
+        {
+            int count = 0;
+            for (int i = 0; i < (int)matches.size(); i++)
+            {
+                if ((rotation * matches[i].left).dot(matches[i].right) < cos_threshold)
+                    continue;
+                count++;
+                if (inliers)
+                    inliers->push_back(i);
+            }
+            return count;
+        }
+
+        // least-squares rotation of the inliers (Kabsch).
+        cv::Matx33d FitRotation(const std::vector<BearingMatch> &matches, const std::vector<int> &inliers)
+        {
+            cv::Matx33d correlation = cv::Matx33d::zeros();
+            for (int i : inliers)
+                correlation += matches[i].right * matches[i].left.t();
+            cv::Mat w, u, vt;
+            cv::SVDecomp(cv::Mat(correlation), w, u, vt);
+            cv::Mat rotation = u * vt;
+            if (cv::determinant(rotation) < 0)
+            {
+                cv::Mat flip = cv::Mat::eye(3, 3, CV_64F);
+                flip.at<double>(2, 2) = -1;
+                rotation = u * flip * vt;
+            }
+            return cv::Matx33d(rotation);
+        }
+
+        double RmsAngle(const std::vector<BearingMatch> &matches, const std::vector<int> &inliers, const cv::Matx33d &rotation)
+        {
+            if (inliers.empty())
+                return 0;
+            double sum = 0;
+            for (int i : inliers)
+            {
+                const double angle = std::acos(std::min(1.0, (rotation * matches[i].left).dot(matches[i].right)));
+                sum += angle * angle;
+            }
+            return std::sqrt(sum / inliers.size()) * 180 / CV_PI;
+        }
+
+        // chord between the rotated left bearing and the right bearing, about the angle for inliers.
+        struct BearingRotationError
+        {
+            BearingRotationError(const cv::Vec3d &left, const cv::Vec3d &right) : left_(left), right_(right) {}
+
+            template <typename T>
+            bool operator()(const T *angle_axis, T *residuals) const
+            {
+                const T left[3] = {T(left_[0]), T(left_[1]), T(left_[2])};
+                T rotated[3];
+                ceres::AngleAxisRotatePoint(angle_axis, left, rotated);
+                for (int i = 0; i < 3; i++)
+                    residuals[i] = rotated[i] - T(right_[i]);
+                return true;
+            }
+
+            static ceres::AutoDiffCostFunction<BearingRotationError, 3, 3> *Create(const cv::Vec3d &left, const cv::Vec3d &right)
+            {
+                return new ceres::AutoDiffCostFunction<BearingRotationError, 3, 3>(new BearingRotationError(left, right));
+            }
+
+            cv::Vec3d left_, right_;
+        };
+    }
+
+    int CollectBearingMatches(const cv::Mat &left, const cv::Mat &right, const KannalaBrandtModel &left_model,
+                              const KannalaBrandtModel &right_model, const TargetlessSettings &settings,
+                              std::vector<BearingMatch> &matches)
+    {
+        cv::Ptr<cv::ORB> orb = cv::ORB::create(settings.max_features);
+        std::vector<cv::KeyPoint> left_keypoints, right_keypoints;
+        cv::Mat left_descriptors, right_descriptors;
+        orb->detectAndCompute(left, cv::noArray(), left_keypoints, left_descriptors);
+        orb->detectAndCompute(right, cv::noArray(), right_keypoints, right_descriptors);
+        if (left_keypoints.empty() || right_keypoints.empty())
+            return 0;
+
+        cv::BFMatcher matcher(cv::NORM_HAMMING);
+        std::vector<std::vector<cv::DMatch>> forward, backward;
+        matcher.knnMatch(left_descriptors, right_descriptors, forward, 2);
+        matcher.knnMatch(right_descriptors, left_descriptors, backward, 2);
+        auto passes_ratio = [&settings](const std::vector<cv::DMatch> &candidates)
+        {
+            return candidates.size() == 1 ||
+                   (candidates.size() >= 2 && candidates[0].distance < settings.match_ratio * candidates[1].distance);
+        };
+
+        int appended = 0;
+        for (const std::vector<cv::DMatch> &candidates : forward)
+        {
+            if (candidates.empty() || !passes_ratio(candidates))
+                continue;
+            const cv::DMatch &match = candidates[0];
+            // mutual best match, the periphery of a fisheye repeats a lot of texture.
+            const std::vector<cv::DMatch> &reverse = backward[match.trainIdx];
+            if (reverse.empty() || reverse[0].trainIdx != match.queryIdx || !passes_ratio(reverse))
+                continue;
+
+            const cv::Point2f &left_point = left_keypoints[match.queryIdx].pt, &right_point = right_keypoints[match.trainIdx].pt;
+            const double left_pixel[2] = {left_point.x, left_point.y}, right_pixel[2] = {right_point.x, right_point.y};
+            BearingMatch bearing_match;
+            if (!left_model.Unproject(left_pixel, bearing_match.left.val) ||
+                !right_model.Unproject(right_pixel, bearing_match.right.val))
+                continue;
+            matches.push_back(bearing_match);
+            appended++;
+        }
+        return appended;
+    }
+
+    bool EstimateRelativeRotation(const std::vector<BearingMatch> &matches, const TargetlessSettings &settings,
+                                  RotationEstimate &estimate)
+    {
+        const int number_matches = (int)matches.size();
+        if (number_matches < kMinInliers)
+        {
+            LOG(ERROR) << "Only " << number_matches << " bearing matches, at least " << kMinInliers << " are needed." << std::endl;
+            return false;
+        }
+
+        const double inlier_angle = settings.inlier_angle * CV_PI / 180, cos_threshold = std::cos(inlier_angle);
+        int best_count = 0, needed = settings.ransac_iterations, drawn = 0;
+        cv::Matx33d best_rotation = cv::Matx33d::eye();
+        std::vector<cv::Matx33d> hypotheses(kRansacRound);
+        std::vector<int> counts(kRansacRound);
+
+        while (drawn < needed)
+        {
+            const int round = std::min(kRansacRound, needed - drawn);
+#pragma omp parallel for schedule(dynamic, 16)
+            for (int h = 0; h < round; h++)
+            {
+                // seeded by the hypothesis index, so the result does not depend on the thread count.
+                cv::RNG rng(0x9e3779b97f4a7c15ULL + drawn + h);
+                const int a = rng.uniform(0, number_matches), b = rng.uniform(0, number_matches);
+                counts[h] = 0;
+                if (a != b && SolveTwoPointRotation(matches[a], matches[b], inlier_angle, hypotheses[h]))
+                    counts[h] = CountInliers(matches, hypotheses[h], cos_threshold);
+            }
+            for (int h = 0; h < round; h++)
+            {
+                if (counts[h] > best_count)
+                {
+                    best_count = counts[h];
+                    best_rotation = hypotheses[h];
+                }
+            }
+            drawn += round;
+
+            // the pairs needed to draw an all-inlier one with the confidence.
+            const double inlier_ratio = (double)best_count / number_matches;
+            if (inlier_ratio > 0)
+            {
+                const double miss = 1 - inlier_ratio * inlier_ratio;
+                const int adaptive = miss <= 0 ? 0 : (int)std::ceil(std::log(1 - kConfidence) / std::log(miss));
+                needed = std::min(settings.ransac_iterations, std::max(adaptive, kRansacRound));
+            }
+        }
+
+        if (best_count < kMinInliers)
+        {
+            LOG(ERROR) << "No rotation is consistent with more than " << best_count << " of the "
+                       << number_matches << " bearing matches." << std::endl;
+            return false;
+        }
+
+        estimate.inliers.clear();
+        CountInliers(matches, best_rotation, cos_threshold, &estimate.inliers);
+        estimate.rotation = FitRotation(matches, estimate.inliers);
+        estimate.inliers.clear();
+        CountInliers(matches, estimate.rotation, cos_threshold, &estimate.inliers);
+        estimate.rms_angle = RmsAngle(matches, estimate.inliers, estimate.rotation);
+
+        LOG(INFO) << "RANSAC keeps " << estimate.inliers.size() << " of " << number_matches << " bearing matches after "
+                  << drawn << " hypotheses, rms angle " << estimate.rms_angle << " deg." << std::endl;
+        return true;
+    }
+
+    void RefineRelativeRotation(const std::vector<BearingMatch> &matches, const TargetlessSettings &settings,
+                                RotationEstimate &estimate)
+    {
+        const cv::Matx33d &rotation = estimate.rotation;
+        // ceres takes the rotation matrices in column-major order.
+        double column_major[9], angle_axis[3];
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 3; col++)
+                column_major[col * 3 + row] = rotation(row, col);
+        ceres::RotationMatrixToAngleAxis(column_major, angle_axis);
+
+        ceres::Problem problem;
+        const double inlier_chord = 2 * std::sin(0.5 * settings.inlier_angle * CV_PI / 180);
+        for (int i : estimate.inliers)
+            problem.AddResidualBlock(BearingRotationError::Create(matches[i].left, matches[i].right),
+                                     new ceres::CauchyLoss(inlier_chord), angle_axis);
+
+        ceres::Solver::Options options;
+        options.linear_solver_type = ceres::DENSE_QR;
+        options.max_num_iterations = 50;
+        options.minimizer_progress_to_stdout = false;
+        ceres::Solver::Summary summary;
+        ceres::Solve(options, &problem, &summary);
+        if (!summary.IsSolutionUsable())
+        {
+            LOG(WARNING) << "The rotation refinement failed, the RANSAC rotation is kept." << std::endl;
+            return;
+        }
+
+        ceres::AngleAxisToRotationMatrix(angle_axis, column_major);
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 3; col++)
+                estimate.rotation(row, col) = column_major[col * 3 + row];
+
+        estimate.inliers.clear();
+        CountInliers(matches, estimate.rotation, std::cos(settings.inlier_angle * CV_PI / 180), &estimate.inliers);
+        estimate.rms_angle = RmsAngle(matches, estimate.inliers, estimate.rotation);
+        LOG(INFO) << "Refined rotation keeps " << estimate.inliers.size() << " inliers, rms angle "
+                  << estimate.rms_angle << " deg." << std::endl;
+    }
+}
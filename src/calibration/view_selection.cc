@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "base/log.h"
+#include "calibration/view_selection.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const int kImageGrid = 10;    // cells per image axis.
+        const int kRadialBins = 8;    // bins from the image center to the corner.
+        const int kTargetHits = 3;    // a cell or bin is saturated after this many views.
+        const int kPilotViews = 8;    // views used to time the pilot calibration.
+        const int kMinViewPoints = 4; // views with fewer points are never selected.
+    }
+
+    ViewDescriptor DescribeCalibrationView(const cv::Size &image_size, const ObservationStore &observations, int view)
+    {
+        const int number_points = observations.ViewSize(view);
+        const cv::Point2f *image_points = observations.ViewPoints(view);
+        const cv::Point3f *object_points = observations.ViewObjectPoints(view);
+        ViewDescriptor descriptor;
+        descriptor.pose = cv::Vec3d(0, 0, 0);
+        descriptor.log_scale = 0;
+
+        // image-plane and radial occupancy, the radius is normalized by the half diagonal
+        // and approximates theta for the equidistant-like fisheye lens.
+        const double cx = image_size.width * 0.5, cy = image_size.height * 0.5;
+        const double r_max = std::sqrt(cx * cx + cy * cy);
+        for (int i = 0; i < number_points; i++)
+        {
+            const cv::Point2f &point = image_points[i];
+            int cell_x = std::min(std::max((int)(point.x / image_size.width * kImageGrid), 0), kImageGrid - 1);
+            int cell_y = std::min(std::max((int)(point.y / image_size.height * kImageGrid), 0), kImageGrid - 1);
+            descriptor.image_cells.push_back(cell_y * kImageGrid + cell_x);
+
+            double r = std::sqrt((point.x - cx) * (point.x - cx) + (point.y - cy) * (point.y - cy));
+            descriptor.radial_bins.push_back(std::min((int)(r / r_max * kRadialBins), kRadialBins - 1));
+        }
+        std::sort(descriptor.image_cells.begin(), descriptor.image_cells.end());
+        descriptor.image_cells.erase(std::unique(descriptor.image_cells.begin(), descriptor.image_cells.end()),
+                                     descriptor.image_cells.end());
+        std::sort(descriptor.radial_bins.begin(), descriptor.radial_bins.end());
+        descriptor.radial_bins.erase(std::unique(descriptor.radial_bins.begin(), descriptor.radial_bins.end()),
+                                     descriptor.radial_bins.end());
+
+        if (number_points < kMinViewPoints)
+            return descriptor;
+
+        // the local affinity from the board plane to the image encodes the board tilt (anisotropy),
+        // its in-plane direction and its distance (scale), which is enough to tell poses apart.
+        cv::Mat A(number_points, 3, CV_64F), B(number_points, 2, CV_64F), X;
+        for (int i = 0; i < number_points; i++)
+        {
+            A.at<double>(i, 0) = object_points[i].x;
+            A.at<double>(i, 1) = object_points[i].y;
+            A.at<double>(i, 2) = 1.0;
+            B.at<double>(i, 0) = image_points[i].x;
+            B.at<double>(i, 1) = image_points[i].y;
+        }
+        if (!cv::solve(A, B, X, cv::DECOMP_SVD))
+            return descriptor;
+
+        cv::Mat affinity = (cv::Mat_<double>(2, 2) << X.at<double>(0, 0), X.at<double>(1, 0),
+                            X.at<double>(0, 1), X.at<double>(1, 1));
+        cv::Mat w, u, vt;
+        cv::SVDecomp(affinity, w, u, vt);
+        const double s1 = w.at<double>(0, 0), s2 = w.at<double>(1, 0);
+        if (s2 <= std::numeric_limits<double>::epsilon())
+            return descriptor;
+
+        const double phi = std::atan2(u.at<double>(1, 0), u.at<double>(0, 0));
+        descriptor.pose = cv::Vec3d(std::log(s1 / s2), std::cos(2 * phi), std::sin(2 * phi));
+        descriptor.log_scale = 0.5 * std::log(s1 * s2);
+        return descriptor;
+    }
+
+    std::vector<int> SelectCalibrationViews(const cv::Size &image_size, const ObservationStore &observations,
+                                            int max_views)
+    {
+        const int number_views = observations.ViewCount();
+        if (max_views <= 0 || max_views > number_views)
+            max_views = number_views;
+
+        std::vector<ViewDescriptor> descriptors(number_views);
+#pragma omp parallel for
+        for (int i = 0; i < number_views; i++)
+        {
+            descriptors[i] = DescribeCalibrationView(image_size, observations, i);
+        }
+
+        std::vector<int> cell_hits(kImageGrid * kImageGrid, 0), bin_hits(kRadialBins, 0);
+        std::vector<double> pose_distance(number_views, 1.0); // distance to the closest selected pose.
+        std::vector<bool> used(number_views, false);
+        std::vector<int> selected_views;
+
+        while ((int)selected_views.size() < max_views)
+        {
+            int best_view = -1;
+            double best_score = 0;
+            for (int i = 0; i < number_views; i++)
+            {
+                if (used[i] || observations.ViewSize(i) < kMinViewPoints)
+                    continue;
+
+                // a fresh board covering a row of cells scores 1 in the image term.
+                double image_gain = 0;
+                for (int cell : descriptors[i].image_cells)
+                    image_gain += std::max(0, kTargetHits - cell_hits[cell]);
+                image_gain /= kTargetHits * kImageGrid;
+
+                // peripheral bins weight twice the central ones since they constrain k1..k4.
+                double radial_gain = 0;
+                for (int bin : descriptors[i].radial_bins)
+                    radial_gain += std::max(0, kTargetHits - bin_hits[bin]) * (1.0 + (double)bin / (kRadialBins - 1));
+                radial_gain /= kTargetHits * 2.0;
+
+                double score = image_gain + radial_gain + pose_distance[i];
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best_view = i;
+                }
+            }
+
+            if (best_view < 0)
+                break;
+
+            used[best_view] = true;
+            selected_views.push_back(best_view);
+            for (int cell : descriptors[best_view].image_cells)
+                cell_hits[cell]++;
+            for (int bin : descriptors[best_view].radial_bins)
+                bin_hits[bin]++;
+            for (int i = 0; i < number_views; i++)
+            {
+                double distance = cv::norm(descriptors[i].pose - descriptors[best_view].pose) +
+                                  0.5 * std::abs(descriptors[i].log_scale - descriptors[best_view].log_scale);
+                pose_distance[i] = std::min(pose_distance[i], distance);
+            }
+        }
+
+        int covered_cells = (int)std::count_if(cell_hits.begin(), cell_hits.end(), [](int hits)
+                                               { return hits > 0; });
+        int covered_bins = (int)std::count_if(bin_hits.begin(), bin_hits.end(), [](int hits)
+                                              { return hits > 0; });
+        LOG(INFO) << "View selection keeps " << selected_views.size() << " of " << number_views
+                  << " views, covering " << covered_cells << "/" << kImageGrid * kImageGrid
+                  << " image cells and " << covered_bins << "/" << kRadialBins << " radial bins."
+                  << std::endl;
+
+        return selected_views;
+    }
+
+    void FitViewsToTimeBudget(const CalibrationSettings &s, const cv::Size &image_size,
+                              const ObservationStore &observations,
+                              double time_budget, std::vector<int> &selected_views)
+    {
+        if (time_budget <= 0 || (int)selected_views.size() <= kPilotViews)
+            return;
+
+        // the pilot is paid from the same budget as the final calibration.
+        const int64 budget_start_tick = cv::getTickCount();
+        const ObservationStore pilot = observations.Subset(
+            std::vector<int>(selected_views.begin(), selected_views.begin() + kPilotViews));
+        std::vector<cv::Mat> pilot_image_points, pilot_object_points;
+        pilot.ImagePointArrays(pilot_image_points);
+        pilot.ObjectPointArrays(pilot_object_points);
+
+        cv::Mat camera_matrix = cv::Mat::eye(3, 3, CV_64F);
+        cv::Mat dist_coeffs = cv::Mat::zeros(4, 1, CV_64F);
+        std::vector<cv::Mat> rvecs, tvecs;
+        int64 start_tick = cv::getTickCount();
+        if (s.use_fisheye_model_)
+            cv::fisheye::calibrate(pilot_object_points, pilot_image_points, image_size, camera_matrix, dist_coeffs,
+                                   rvecs, tvecs, s.flag_);
+        else
+            cv::calibrateCamera(pilot_object_points, pilot_image_points, image_size, camera_matrix, dist_coeffs,
+                                rvecs, tvecs, s.flag_ | cv::CALIB_FIX_K4 | cv::CALIB_FIX_K5);
+        const int64 end_tick = cv::getTickCount();
+        double seconds_per_view = (end_tick - start_tick) / cv::getTickFrequency() / kPilotViews;
+        double remaining_budget = time_budget - (end_tick - budget_start_tick) / cv::getTickFrequency();
+
+        // the solver cost grows slightly faster than linear, keep a margin.
+        int budget_views = std::max(kPilotViews,
+                                    (int)(0.8 * std::max(remaining_budget, 0.0) / std::max(seconds_per_view, 1e-6)));
+        if (budget_views < (int)selected_views.size())
+        {
+            LOG(INFO) << "Time budget of " << time_budget << " s allows " << budget_views
+                      << " views (" << seconds_per_view << " s per view in the pilot, " << std::max(remaining_budget, 0.0)
+                      << " s left after it)." << std::endl;
+            selected_views.resize(budget_views);
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include "base/log.h"
+#include "calibration/camera_models.h"
+#include "calibration/vignetting.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const int kFitIterations = 20;
+        const float kSaturatedIntensity = 250;
+        const float kDarkIntensity = 10;
+    }
+
+    void CollectVignettingSamples(const cv::Mat &gray, int view, const std::vector<cv::Point2f> &points,
+                                  const std::vector<int> &point_ids, const cv::Size &board_size,
+                                  std::vector<VignettingSample> &samples)
+    {
+        std::vector<int> point_of_id(board_size.area(), -1);
+        for (int i = 0; i < (int)point_ids.size(); i++)
+            point_of_id[point_ids[i]] = i;
+
+        // the two parities of the squares, the brighter one is the white squares of this view.
+        std::vector<VignettingSample> parity_samples[2];
+        double parity_sum[2] = {0, 0};
+        const cv::Rect image_rect(0, 0, gray.cols, gray.rows);
+        for (int row = 0; row + 1 < board_size.height; row++)
+        {
+            for (int col = 0; col + 1 < board_size.width; col++)
+            {
+                const int ids[4] = {row * board_size.width + col, row * board_size.width + col + 1,
+                                    (row + 1) * board_size.width + col, (row + 1) * board_size.width + col + 1};
+                cv::Point2f center(0, 0);
+                bool complete = true;
+                for (int id : ids)
+                {
+                    complete = complete && point_of_id[id] >= 0;
+                    if (complete)
+                        center += 0.25f * points[point_of_id[id]];
+                }
+                if (!complete)
+                    continue;
+                const float side = std::min((float)cv::norm(points[point_of_id[ids[0]]] - points[point_of_id[ids[3]]]),
+                                            (float)cv::norm(points[point_of_id[ids[1]]] - points[point_of_id[ids[2]]])) / std::sqrt(2.0f);
+
+                // a quarter of the square, away from the blurred edges.
+                const int half = std::max(1, (int)(side / 8));
+                const cv::Rect patch = cv::Rect(cvRound(center.x) - half, cvRound(center.y) - half, 2 * half + 1, 2 * half + 1) & image_rect;
+                if (patch.area() == 0)
+                    continue;
+
+                VignettingSample sample;
+                sample.view = view;
+                sample.pixel = center;
+                sample.intensity = (float)cv::mean(gray(patch))[0];
+                const int parity = (row + col) % 2;
+                parity_samples[parity].push_back(sample);
+                parity_sum[parity] += sample.intensity;
+            }
+        }
+
+        const int white = parity_sum[0] / std::max<size_t>(1, parity_samples[0].size()) >=
+                                  parity_sum[1] / std::max<size_t>(1, parity_samples[1].size())
+                              ? 0
+                              : 1;
+        for (const VignettingSample &sample : parity_samples[white])
+        {
+            // clipped samples carry no falloff information.
+            if (sample.intensity < kSaturatedIntensity && sample.intensity > kDarkIntensity)
+                samples.push_back(sample);
+        }
+    }
+
+    VignettingModel FitVignettingModel(const std::vector<VignettingSample> &samples, const cv::Mat &intrinsic,
+                                       const cv::Mat &distortion_coefficient, const cv::Size &image_size, int degree)
+    {
+        VignettingModel vignetting;
+        if ((int)samples.size() < 4 * degree)
+        {
+            LOG(WARNING) << "Only " << samples.size() << " vignetting samples, the vignetting is not calibrated." << std::endl;
+            return vignetting;
+        }
+
+        const KannalaBrandtModel model(intrinsic, distortion_coefficient,
+                                       FitKBInverseModel(intrinsic, distortion_coefficient, image_size));
+        std::map<int, int> view_index;
+        std::vector<double> thetas(samples.size());
+        for (int i = 0; i < (int)samples.size(); i++)
+        {
+            double pixel[2] = {samples[i].pixel.x, samples[i].pixel.y}, ray[3];
+            model.Unproject(pixel, ray);
+            thetas[i] = std::acos(std::max(-1.0, std::min(1.0, ray[2])));
+            vignetting.max_theta = std::max(vignetting.max_theta, thetas[i]);
+            view_index.insert(std::make_pair(samples[i].view, (int)view_index.size()));
+        }
+
+        // the exposure of every view is unknown, alternate between the exposures and the falloff.
+        std::vector<double> exposures(view_index.size(), 0), falloffs(samples.size(), 1.0);
+        cv::Mat A((int)samples.size(), degree, CV_64F), b((int)samples.size(), 1, CV_64F), x;
+        for (int iteration = 0; iteration < kFitIterations; iteration++)
+        {
+            std::vector<double> numerator(view_index.size(), 0), denominator(view_index.size(), 0);
+            for (int i = 0; i < (int)samples.size(); i++)
+            {
+                int view = view_index[samples[i].view];
+                numerator[view] += samples[i].intensity * falloffs[i];
+                denominator[view] += falloffs[i] * falloffs[i];
+            }
+            for (int view = 0; view < (int)exposures.size(); view++)
+                exposures[view] = numerator[view] / denominator[view];
+
+            for (int i = 0; i < (int)samples.size(); i++)
+            {
+                double exposure = exposures[view_index[samples[i].view]];
+                double theta2 = thetas[i] * thetas[i], power = theta2;
+                for (int k = 0; k < degree; k++, power *= theta2)
+                    A.at<double>(i, k) = exposure * power;
+                b.at<double>(i, 0) = samples[i].intensity - exposure;
+            }
+            cv::solve(A, b, x, cv::DECOMP_SVD);
+            vignetting.coefficients.assign(x.ptr<double>(), x.ptr<double>() + degree);
+            for (int i = 0; i < (int)samples.size(); i++)
+                falloffs[i] = 1.0 / vignetting.Gain(thetas[i]);
+        }
+
+        double squared_error = 0;
+        for (int i = 0; i < (int)samples.size(); i++)
+        {
+            double relative_error = exposures[view_index[samples[i].view]] * falloffs[i] / samples[i].intensity - 1;
+            squared_error += relative_error * relative_error;
+        }
+        LOG(INFO) << "Vignetting fitted from " << samples.size() << " samples of " << exposures.size()
+                  << " views, falloff " << 1.0 / vignetting.Gain(vignetting.max_theta)
+                  << " at theta " << vignetting.max_theta * 180 / CV_PI
+                  << " deg, relative rms error " << std::sqrt(squared_error / samples.size()) << "."
+                  << std::endl;
+        return vignetting;
+    }
+
+    void WriteVignettingModel(cv::FileStorage &fs, const VignettingModel &vignetting)
+    {
+        fs << "Vignetting_Coefficients" << cv::Mat(vignetting.coefficients);
+        fs << "Vignetting_Max_Theta" << vignetting.max_theta;
+    }
+
+    bool ReadVignettingModel(const cv::FileStorage &fs, VignettingModel &vignetting)
+    {
+        return ReadVignettingModel(fs.root(), vignetting);
+    }
+
+    bool ReadVignettingModel(const cv::FileNode &node, VignettingModel &vignetting)
+    {
+        cv::Mat coefficients;
+        node["Vignetting_Coefficients"] >> coefficients;
+        if (coefficients.empty())
+            return false;
+
+        coefficients.convertTo(coefficients, CV_64F);
+        vignetting.coefficients.assign(coefficients.ptr<double>(), coefficients.ptr<double>() + coefficients.total());
+        node["Vignetting_Max_Theta"] >> vignetting.max_theta;
+        return vignetting.max_theta > 0;
+    }
+}
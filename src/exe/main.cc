@@ -34,12 +34,29 @@
 #include <vector>
 #include <functional>
 #include <iomanip>
+#include <fstream>
+#include <cstdio>
+#include <map>
+#include <sstream>
 
 #include "base/string_format.h"
 #include "base/log.h"
 #include "calibration/calibration_base.h"
 #include "calibration/intrinsic_calibration.h"
+#include "calibration/pattern_detector.h"
+#include "calibration/corner_tracker.h"
+#include "calibration/targetless_extrinsics.h"
+#include "calibration/camera_registry.h"
 #include "panoramic_process/panoramic_stitching.h"
+#include "panoramic_process/fused_remap.h"
+#include "panoramic_process/stereo_depth.h"
+#include "panoramic_process/remap_table_file.h"
+#include "base/worker_process.h"
+#include "base/job_scheduler.h"
+
+#ifdef _USE_OPENMP
+#include <omp.h>
+#endif
 
 typedef std::function<int(int, char **)> command_func_t;
 
@@ -74,22 +91,17 @@ int ShowHelp(const std::vector<std::pair<std::string, command_func_t>> &commands
     return EXIT_SUCCESS;
 }
 
-int RunIntrinsicCalibration(int argc, char **argv)
+// Reads the Settings node of the configuration file of a command, false if it is missing or invalid.
+bool ReadCommandSettings(const std::string &input_settings_file, fishcat::CalibrationSettings &s)
 {
-    fishcat::IntrinsicCalibrationHelp();
-    fishcat::CalibrationSettings s;
-    const std::string input_settings_file = argc > 1 ? argv[1] : "test.xml";
-
-    // reading the input file and checking.
     cv::FileStorage fs(input_settings_file, cv::FileStorage::READ); // Read the CalibrationSettings
-
     if (!fs.isOpened())
     {
         LOG(ERROR) << "Could not open the configuration file: \""
                    << input_settings_file
                    << "\""
                    << std::endl;
-        return EXIT_FAILURE;
+        return false;
     }
 
     // from the setting in the xml file.
@@ -100,66 +112,153 @@ int RunIntrinsicCalibration(int argc, char **argv)
     {
         LOG(ERROR) << "Invalid input detected. Application stopping. "
                    << std::endl;
-        return EXIT_FAILURE;
+        return false;
     }
+    return true;
+}
+
+int RunIntrinsicCalibration(int argc, char **argv)
+{
+    fishcat::IntrinsicCalibrationHelp();
+    fishcat::CalibrationSettings s;
+    const std::string input_settings_file = argc > 1 ? argv[1] : "test.xml";
+
+    if (!ReadCommandSettings(input_settings_file, s))
+        return EXIT_FAILURE;
 
     // preparing the image for calibration.
-    std::vector<std::vector<cv::Point2f>> image_points;
-    std::vector<std::vector<cv::Point3f>> object_points;
+    std::vector<fishcat::VignettingSample> vignetting_samples;
     cv::Mat camera_matrix, dist_coeffs;
     cv::Size image_size;
 
     const cv::Scalar RED(0, 0, 255), GREEN(0, 255, 0);
     int current_image_index = 0;
 
+    std::unique_ptr<fishcat::PatternDetector> detector = fishcat::CreatePatternDetector(s);
+    if (!detector)
+    {
+        LOG(ERROR) << "Not suitable board found."
+                   << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // consecutive video frames are tracked instead of detected from scratch.
+    fishcat::CornerTracker tracker(*detector);
+    fishcat::ObservationStore observations(detector->BoardPoints());
+    const int image_count = s.ImageCount();
+    // the corners grow with the detections, many images show no board or no new view.
+    observations.Reserve(std::max(image_count, 0), 0);
+
+    // the board is searched on a DCT-reduced gray decode and refined at full resolution.
+    const int decode_scale = s.btrack_corners_ ? 1 : s.decode_scale_;
+
     // Processing the images.
-    for (int i = 0; i < s.image_list_.size(); i++)
+    while (s.HasNextImage())
     {
-        int chessBoardFlags;
-        cv::Mat view, view_gray;
+        cv::Mat view_gray;
         std::vector<cv::Point2f> point_buf;
-        std::vector<cv::Point3f> object_point;
+        std::vector<int> point_ids;
+
+        view_gray = s.NextGrayImage(decode_scale);
+        if (view_gray.empty())
+        {
+            if (s.input_type_ != fishcat::CalibrationSettings::VIDEO_FILE)
+                LOG(WARNING) << "Image is missing, name of : "
+                             << s.current_image_name_
+                             << std::endl;
+            continue;
+        }
+
+        bool found;
+        std::vector<float> confidences;
+        if (s.btrack_corners_)
+            found = tracker.Process(view_gray, point_buf, point_ids, &confidences);
+        else
+            found = detector->Detect(view_gray, point_buf, point_ids, &confidences);
+
+        if (decode_scale > 1)
+        {
+            cv::Mat reduced_gray = view_gray;
+            view_gray = s.CurrentGrayImage();
+            if (view_gray.empty())
+            {
+                LOG(WARNING) << "Image cannot be decoded at full resolution, name of : "
+                             << s.current_image_name_
+                             << std::endl;
+                continue;
+            }
+            if (found)
+            {
+                // centers of the reduced pixels back to the full resolution.
+                for (cv::Point2f &point : point_buf)
+                {
+                    point.x = (point.x + 0.5f) * view_gray.cols / reduced_gray.cols - 0.5f;
+                    point.y = (point.y + 0.5f) * view_gray.rows / reduced_gray.rows - 0.5f;
+                }
+                detector->RefinePoints(view_gray, point_buf, &confidences);
+            }
+            else
+            {
+                found = detector->Detect(view_gray, point_buf, point_ids, &confidences);
+            }
+        }
+        image_size = view_gray.size(); // Format input image.
+
+        // a tracked stream only adds the frames where the board moved, the others repeat a view.
+        if (found && s.btrack_corners_ && !tracker.IsKeyframe(point_buf, point_ids, view_gray.size()))
+        {
+            fishcat::LogItem("Processing image {0,4} in {1} images, named of : {2}, no new view", current_image_index,
+                             image_count, s.current_image_name_);
+            current_image_index++;
+            continue;
+        }
 
-        switch (s.calibration_pattern_)
+        if (found)
+        {
+            if (s.bcalibrate_vignetting_)
+                fishcat::CollectVignettingSamples(view_gray, observations.ViewCount(), point_buf, point_ids,
+                                                  s.board_size_, vignetting_samples);
+            observations.AddView(point_buf, point_ids);
+
+            if (!confidences.empty())
+            {
+                double confidence_sum = 0;
+                int weak_corners = 0;
+                for (float confidence : confidences)
+                {
+                    confidence_sum += confidence;
+                    weak_corners += confidence > 0 ? 0 : 1;
+                }
+                fishcat::LogItem("{0}: mean corner confidence {1}, {2} corners without a saddle.", s.current_image_name_,
+                                 confidence_sum / confidences.size(), weak_corners);
+            }
+        }
+        else
         {
-        case fishcat::CalibrationSettings::CHESSBOARD:
-            view = s.NextImage();
-            image_size = view.size(); // Format input image.
-
-            cv::cvtColor(view, view_gray, cv::COLOR_BGR2GRAY);
-
-            chessBoardFlags = cv::CALIB_CB_ADAPTIVE_THRESH;
-            cv::findChessboardCorners(view_gray, s.board_size_, point_buf, chessBoardFlags);
-            cv::cornerSubPix(view_gray, point_buf, cv::Size(11, 11),
-                             cv::Size(-1, -1), cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.1));
-            for (int i = 0; i < s.board_size_.height; ++i)
-                for (int j = 0; j < s.board_size_.width; ++j)
-                    object_point.push_back(cv::Point3f(j * s.square_size_, i * s.square_size_, 0));
-
-            image_points.push_back(point_buf);
-            object_points.push_back(object_point);
-
-            break;
-        default:
-            LOG(WARNING) << "Not suitable board found."
+            LOG(WARNING) << "No board detected in image : "
+                         << s.current_image_name_
                          << std::endl;
-            break;
         }
 
-        LOG(INFO) << "Processing image " << std::setw(4) << current_image_index
-                  << " in " << s.image_list_.size()
-                  << " images, named of : "
-                  << s.image_list_[i]
-                  << std::endl;
+        fishcat::LogItem("Processing image {0,4} in {1} images, named of : {2}", current_image_index, image_count,
+                         s.current_image_name_);
         current_image_index++;
     }
+    fishcat::FlushItemLog();
+
+    if (s.btrack_corners_)
+    {
+        LOG(INFO) << "Boards are tracked in " << tracker.tracked_frames_
+                  << " frames and detected in " << tracker.detected_frames_ << " frames, "
+                  << tracker.keyframes_ << " of them are kept as views." << std::endl;
+    }
 
     // here saves the re-projection error.
-    if (image_points.size() > 0)
+    if (observations.ViewCount() > 0)
     {
         LOG(INFO) << "Images are all detected for their corner points, and will be calibrated."
                   << std::endl;
-        RunCalibrationAndSave(s, image_size, camera_matrix, dist_coeffs, image_points, object_points);
+        RunCalibrationAndSave(s, image_size, camera_matrix, dist_coeffs, observations, vignetting_samples);
     }
     else
     {
@@ -173,38 +272,64 @@ int RunIntrinsicCalibration(int argc, char **argv)
     // -----------------------Show the undistorted image for the image list ------------------------
     if (s.show_undistorsed_)
     {
-        cv::Mat map1, map2;
+        cv::Mat map_x, map_y, map1, map2;
         if (s.use_fisheye_model_)
         {
-            cv::fisheye::initUndistortRectifyMap(camera_matrix, dist_coeffs, cv::Mat(),
-                                                 cv::getOptimalNewCameraMatrix(camera_matrix, dist_coeffs, image_size, 1, image_size, 0), image_size, CV_16SC2, map1, map2);
+            // the undistortion map is built by the specialized KB kernel, with the fitted inverse for the FOV bound.
+            fishcat::KannalaBrandtModel model(camera_matrix, dist_coeffs,
+                                              fishcat::FitKBInverseModel(camera_matrix, dist_coeffs, image_size));
+            fishcat::BuildPerspectiveMap(model, cv::getOptimalNewCameraMatrix(camera_matrix, dist_coeffs, image_size, 1, image_size, 0),
+                                         cv::Mat(), image_size, map_x, map_y);
         }
         else
         {
             initUndistortRectifyMap(camera_matrix, dist_coeffs, cv::Mat(),
                                     getOptimalNewCameraMatrix(camera_matrix, dist_coeffs, image_size, 1, image_size, 0),
-                                    image_size, CV_16SC2, map1, map2);
+                                    image_size, CV_32FC1, map_x, map_y);
         }
+        // the tiles are ordered on the float maps, then the maps are packed for cv::remap.
+        fishcat::RemapTiling tiling;
+        fishcat::BuildRemapTiling(map_x, map_y, image_size, s.expansion_.tile_size > 0 ? s.expansion_.tile_size : 64, tiling);
+        cv::convertMaps(map_x, map_y, map1, map2, CV_16SC2);
 
-#pragma omp parallel for
-        for (int i = 0; i < (int)s.image_list_.size(); i++)
+        // the list is streamed again in batches, the images of a batch are decoded and written in parallel.
+        const int kUndistortBatch = 64;
+        std::vector<std::string> names, paths;
+        fishcat::ImageManifest manifest;
+        const bool has_images = s.input_type_ == fishcat::CalibrationSettings::IMAGE_LIST && manifest.Open(s.input_, s.image_path_);
+        fishcat::ProgressLog progress("Undistorted images", std::max(image_count, 0));
+        while (has_images && manifest.HasNext())
         {
-            cv::Mat view, rview;
-            std::string image_path = s.image_path_ + s.image_list_[i];
-            view = cv::imread(image_path, 1);
-            if (view.empty())
+            names.clear();
+            paths.clear();
+            std::string name, path;
+            while ((int)names.size() < kUndistortBatch && manifest.Next(name, path))
             {
-                LOG(WARNING) << "Image is missing, name of : "
-                             << image_path
-                             << std::endl;
-                continue;
+                names.push_back(name);
+                paths.push_back(path);
+            }
+
+#pragma omp parallel for
+            for (int i = 0; i < (int)names.size(); i++)
+            {
+                cv::Mat view, rview;
+                view = cv::imread(paths[i], 1);
+                if (view.empty())
+                {
+                    LOG(WARNING) << "Image is missing, name of : "
+                                 << paths[i]
+                                 << std::endl;
+                    continue;
+                }
+                fishcat::TiledRemap(view, map1, map2, tiling, rview);
+                fishcat::LogItem("Saving the undistorted images named : {0}", names[i]);
+                std::string undistorted_image_path = s.image_path_ + STRING_FORMAT("undistorted_image_{0}.jpg", names[i]);
+                cv::imwrite(undistorted_image_path, rview);
+                progress.Step();
             }
-            cv::remap(view, rview, map1, map2, cv::INTER_LINEAR);
-            LOG(INFO) << "Saving the undistorted images named : " + s.image_list_[i]
-                      << std::endl;
-            std::string undistorted_image_path = s.image_path_ + stringformat::Format("undistorted_image_{0}.jpg", s.image_list_[i]);
-            cv::imwrite(undistorted_image_path, rview);
         }
+        if (has_images)
+            progress.Finish();
     }
 
     return EXIT_SUCCESS;
@@ -216,76 +341,838 @@ int RunPanoramicStitching(int argc, char **argv)
     fishcat::CalibrationSettings s;
     const std::string input_settings_file = argc > 1 ? argv[1] : "test.xml";
 
-    // reading the input file and checking.
-    cv::FileStorage fs(input_settings_file, cv::FileStorage::READ); // Read the CalibrationSettings
+    if (!ReadCommandSettings(input_settings_file, s))
+        return EXIT_FAILURE;
 
-    if (!fs.isOpened())
+    return EXIT_SUCCESS;
+}
+
+// Camera and remap tables of the fisheye expansion, the tables are built once per source size.
+struct ExpansionContext
+{
+    fishcat::CameraRecord camera;
+    cv::Mat intrinsic, coefficients;
+    fishcat::KBInverseModel inverse_model;
+    bool has_inverse_model = false;
+    fishcat::VignettingModel vignetting;
+    bool has_vignetting = false;
+    fishcat::CameraModelType model_type = fishcat::KANNALA_BRANDT;
+    fishcat::RemapOutputFormat output_format = fishcat::REMAP_BGR;
+    bool fused = false;
+
+    cv::Size image_size;
+    cv::Mat map_x, map_y, gain, lod; // float tables of the output, possibly over a shared mapping.
+    cv::Mat map1, map2;              // tables handed to the remap.
+    fishcat::RemapTiling tiling;
+    std::vector<cv::Mat> pyramid;
+    std::shared_ptr<fishcat::MappedRemapTables> linked_tables; // precomputed tables of the registry camera.
+};
+
+// Hash of the expansion settings the remap tables depend on, a registry camera links its tables with it.
+uint64_t ExpansionTablesKey(const fishcat::ExpansionSettings &expansion)
+{
+    // the raw values, adding 0 folds -0 into 0 so equal settings give equal bytes.
+    const double values[] = {(double)expansion.output_size.width, (double)expansion.output_size.height,
+                             expansion.yaw + 0.0, expansion.pitch + 0.0, expansion.roll + 0.0,
+                             expansion.longitude_min + 0.0, expansion.longitude_max + 0.0,
+                             expansion.latitude_min + 0.0, expansion.latitude_max + 0.0,
+                             (double)expansion.roi.x, (double)expansion.roi.y, (double)expansion.roi.width,
+                             (double)expansion.roi.height, (double)expansion.downscale, expansion.antialias ? 1.0 : 0.0};
+    return fishcat::CameraRegistryHash(values, sizeof(values));
+}
+
+bool ReadExpansionContext(const fishcat::CalibrationSettings &s, ExpansionContext &context)
+{
+    // a registry camera is looked up in the mapping, a camera file is parsed.
+    if (!fishcat::ReadSettingsCamera(s, context.camera))
+        return false;
+    context.intrinsic = context.camera.intrinsic;
+    context.coefficients = context.camera.coefficients;
+
+    // fit the inverse polynomial once if the camera does not carry it.
+    context.inverse_model = context.camera.inverse_model;
+    context.has_inverse_model = !context.inverse_model.coefficients.empty();
+    // the vignetting gain rides along the remap tables, so it needs the fused kernel.
+    context.vignetting = context.camera.vignetting;
+    context.has_vignetting = !context.vignetting.coefficients.empty();
+    context.model_type = context.camera.model_type;
+
+    // anything but a full size BGR output is written by the fused kernel in the encoder format.
+    context.output_format = fishcat::ParseRemapOutputFormat(s.expansion_.output_format);
+    if (context.output_format == fishcat::REMAP_UNKNOWN_FORMAT)
     {
-        LOG(ERROR) << "Could not open the configuration file: \""
-                   << input_settings_file
-                   << "\""
-                   << std::endl;
+        LOG(ERROR) << "Unknown expansion output format " << s.expansion_.output_format
+                   << ", should be BGR, GRAY, I420 or NV12." << std::endl;
+        return false;
+    }
+    // the antialiased gather samples a source pyramid at the level of detail stored next to the tables.
+    context.fused = context.output_format != fishcat::REMAP_BGR || s.expansion_.downscale > 1 ||
+                    context.has_vignetting || s.expansion_.antialias;
+    return true;
+}
+
+// the float tables of the given source size.
+bool BuildExpansionTables(const fishcat::CalibrationSettings &s, const cv::Size &image_size, ExpansionContext &context)
+{
+    // linked tables are headers over a read-only mapping, the new tables must not be written into it.
+    context.map_x.release();
+    context.map_y.release();
+    context.gain.release();
+    context.lod.release();
+    context.linked_tables.reset();
+
+    if (context.model_type == fishcat::KANNALA_BRANDT && !context.has_inverse_model)
+        context.inverse_model = fishcat::FitKBInverseModel(context.intrinsic, context.coefficients, image_size);
+    cv::Mat map_x, map_y;
+    if (!fishcat::BuildExpansionMap(context.model_type, context.intrinsic, context.coefficients, context.inverse_model,
+                                    s.expansion_, map_x, map_y))
+        return false;
+    if (s.expansion_.downscale > 1)
+        fishcat::DownscaleRemapTable(map_x, map_y, s.expansion_.downscale, context.map_x, context.map_y);
+    else
+        context.map_x = map_x, context.map_y = map_y;
+
+    if (context.has_vignetting &&
+        !fishcat::BuildVignettingGain(context.model_type, context.intrinsic, context.coefficients, context.inverse_model,
+                                      context.vignetting, context.map_x, context.map_y, context.gain))
+        return false;
+    if (s.expansion_.antialias)
+        fishcat::BuildRemapLod(context.map_x, context.map_y, context.lod);
+    context.image_size = image_size;
+    return true;
+}
+
+// the tiling and the remap tables from the float tables.
+void PrepareExpansionRemap(const fishcat::CalibrationSettings &s, ExpansionContext &context)
+{
+    if (s.expansion_.tile_size > 0)
+        fishcat::BuildRemapTiling(context.map_x, context.map_y, context.image_size, s.expansion_.tile_size, context.tiling);
+    if (context.fused)
+        context.map1 = context.map_x, context.map2 = context.map_y;
+    else
+        cv::convertMaps(context.map_x, context.map_y, context.map1, context.map2, CV_16SC2);
+}
+
+// Maps the remap tables the camera links for these settings instead of building them, false if there are none.
+bool MapLinkedExpansionTables(const fishcat::CalibrationSettings &s, ExpansionContext &context)
+{
+    if (context.camera.remap_tables.empty() || context.camera.remap_key != ExpansionTablesKey(s.expansion_))
+        return false;
+    std::shared_ptr<fishcat::MappedRemapTables> tables = std::make_shared<fishcat::MappedRemapTables>();
+    if (!tables->Open(context.camera.remap_tables) || tables->Tables().size() != 4)
+        return false;
+    context.linked_tables = tables;
+    context.image_size = tables->SourceSize();
+    context.map_x = tables->Tables()[0];
+    context.map_y = tables->Tables()[1];
+    context.gain = tables->Tables()[2];
+    context.lod = tables->Tables()[3];
+    PrepareExpansionRemap(s, context);
+    return true;
+}
+
+bool ExpandImage(const fishcat::CalibrationSettings &s, const cv::Mat &view, ExpansionContext &context,
+                 cv::Mat &expanded_image)
+{
+    const fishcat::RemapTiling *remap_tiling = s.expansion_.tile_size > 0 ? &context.tiling : nullptr;
+    if (s.expansion_.antialias)
+    {
+        fishcat::BuildRemapPyramid(view, context.lod, context.pyramid);
+        return fishcat::FusedRemap(context.pyramid, context.map1, context.map2, context.lod, context.output_format,
+                                   expanded_image, context.gain, remap_tiling);
+    }
+    if (context.fused)
+        return fishcat::FusedRemap(view, context.map1, context.map2, context.output_format, expanded_image,
+                                   context.gain, remap_tiling);
+    fishcat::FisheyeExpansion(view, context.map1, context.map2, expanded_image, remap_tiling);
+    return true;
+}
+
+// Expands at most frame_limit frames (all for a negative limit) from the current input position.
+// The 4:2:0 frames go to the raw stream if one is given, every other frame to its own file.
+bool ExpandInputFrames(fishcat::CalibrationSettings &s, ExpansionContext &context, int frame_limit, std::ofstream *raw_stream)
+{
+    const bool planar = context.output_format == fishcat::REMAP_YUV_I420 || context.output_format == fishcat::REMAP_NV12;
+    cv::Mat view, expanded_image;
+    fishcat::ProgressLog progress("Expanded frames", frame_limit >= 0 ? frame_limit : std::max(s.ImageCount(), 0));
+
+    for (int frames = 0; s.HasNextImage() && (frame_limit < 0 || frames < frame_limit); frames++)
+    {
+        view = s.NextImage();
+        if (view.empty())
+        {
+            LOG(WARNING) << "Image is missing, name of : "
+                         << s.current_image_name_
+                         << std::endl;
+            continue;
+        }
+
+        // the remap tables only depend on the camera and the output, build them once.
+        if (view.size() != context.image_size)
+        {
+            if (!BuildExpansionTables(s, view.size(), context))
+                return false;
+            PrepareExpansionRemap(s, context);
+        }
+
+        if (!ExpandImage(s, view, context, expanded_image))
+            return false;
+
+        progress.Step();
+        if (planar && raw_stream)
+        {
+            raw_stream->write((const char *)expanded_image.data, expanded_image.total());
+            continue;
+        }
+
+        fishcat::LogItem("Saving the expanded image of : {0}", s.current_image_name_);
+        std::string expanded_name = stringformat::StringTrimExtension(s.current_image_name_);
+        if (planar)
+        {
+            // raw planes for the encoder, the size is the one of the Y plane.
+            std::string expanded_image_path = s.image_path_ + STRING_FORMAT("expanded_image_{0}_{1}x{2}.{3}", expanded_name,
+                                                                           expanded_image.cols, expanded_image.rows * 2 / 3,
+                                                                           context.output_format == fishcat::REMAP_NV12 ? "nv12" : "yuv");
+            std::ofstream raw(expanded_image_path.c_str(), std::ios::binary);
+            raw.write((const char *)expanded_image.data, expanded_image.total());
+        }
+        else
+        {
+            std::string expanded_image_path = s.image_path_ + STRING_FORMAT("expanded_image_{0}.jpg", expanded_name);
+            cv::imwrite(expanded_image_path, expanded_image);
+        }
+    }
+
+    progress.Finish();
+    return true;
+}
+
+// the workers share the cores, every one gets its slice of the thread pools.
+void LimitWorkerThreads(int workers)
+{
+    const int threads = std::max(1, cv::getNumberOfCPUs() / workers);
+    cv::setNumThreads(threads);
+#ifdef _USE_OPENMP
+    omp_set_num_threads(threads);
+#endif
+}
+
+int RunFisheyeExpansion(int argc, char **argv)
+{
+    fishcat::IntrinsicCalibrationHelp();
+    fishcat::CalibrationSettings s;
+    const std::string input_settings_file = argc > 1 ? argv[1] : "test.xml";
+    // a worker of a segmented video runs with --segment index count.
+    const bool is_worker = argc > 4 && std::string(argv[2]) == "--segment";
+
+    if (!ReadCommandSettings(input_settings_file, s))
         return EXIT_FAILURE;
+
+    ExpansionContext context;
+    if (!ReadExpansionContext(s, context))
+        return EXIT_FAILURE;
+    // the tables are only rebuilt if the input size differs from the one they were linked for.
+    if (!is_worker && MapLinkedExpansionTables(s, context))
+        LOG(INFO) << "Using the remap tables " << context.camera.remap_tables << " of the camera " << context.camera.id
+                  << std::endl;
+
+    if (s.input_type_ != fishcat::CalibrationSettings::VIDEO_FILE)
+        return ExpandInputFrames(s, context, -1, nullptr) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // a video is written as one raw stream for the 4:2:0 formats, so the segments concatenate losslessly.
+    const bool planar = context.output_format == fishcat::REMAP_YUV_I420 || context.output_format == fishcat::REMAP_NV12;
+    const std::string video_name = stringformat::StringTrimExtension(s.input_.substr(s.input_.rfind('/') + 1));
+    const std::string table_path = s.image_path_ + STRING_FORMAT("expansion_tables_{0}.bin", video_name);
+    auto stream_path = [&](const cv::Size &output_size)
+    {
+        return s.image_path_ + STRING_FORMAT("expanded_{0}_{1}x{2}.{3}", video_name, output_size.width, output_size.height,
+                                             context.output_format == fishcat::REMAP_NV12 ? "nv12" : "yuv");
+    };
+    auto part_path = [&](const cv::Size &output_size, int segment)
+    {
+        return stream_path(output_size) + STRING_FORMAT(".part{0}", segment);
+    };
+
+    if (is_worker)
+    {
+        const int segment = atoi(argv[3]), segments = std::max(1, atoi(argv[4]));
+        fishcat::MappedRemapTables tables;
+        if (!tables.Open(table_path) || tables.Tables().size() != 4)
+            return EXIT_FAILURE;
+        context.image_size = tables.SourceSize();
+        context.map_x = tables.Tables()[0];
+        context.map_y = tables.Tables()[1];
+        context.gain = tables.Tables()[2];
+        context.lod = tables.Tables()[3];
+        PrepareExpansionRemap(s, context);
+        LimitWorkerThreads(segments);
+
+        // the last segment runs to the end of the stream, the frame count of a container may be approximate.
+        const int frame_count = s.ImageCount();
+        const int begin = frame_count * segment / segments, end = frame_count * (segment + 1) / segments;
+        if (frame_count <= 0 || !s.SeekFrame(begin))
+        {
+            LOG(ERROR) << "Could not seek the segment " << segment << " at frame " << begin << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::ofstream stream;
+        if (planar)
+            stream.open(part_path(context.map_x.size(), segment).c_str(), std::ios::binary);
+        return ExpandInputFrames(s, context, segment + 1 < segments ? end - begin : -1, planar ? &stream : nullptr)
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
     }
 
-    // from the setting in the xml file.
-    fs["Settings"] >> s;
-    fs.release(); // close CalibrationSettings file
+    // the tables are built from the first frame, unless the linked ones fit it.
+    cv::Mat first_frame = s.NextImage();
+    if (first_frame.empty() ||
+        (first_frame.size() != context.image_size && !BuildExpansionTables(s, first_frame.size(), context)) ||
+        !s.SeekFrame(0))
+    {
+        LOG(ERROR) << "Could not read the first frame of " << s.input_ << std::endl;
+        return EXIT_FAILURE;
+    }
+    const cv::Size output_size = context.map_x.size();
 
-    if (!s.good_input_)
+    // the segments are cut from the frame count, a stream without one is decoded by a single process.
+    bool single_process = s.expansion_.workers == 1;
+    if (!single_process && s.ImageCount() <= 0)
     {
-        LOG(ERROR) << "Invalid input detected. Application stopping. "
-                   << std::endl;
+        LOG(WARNING) << s.input_ << " reports no frame count, it is expanded in one process." << std::endl;
+        single_process = true;
+    }
+
+    if (single_process)
+    {
+        PrepareExpansionRemap(s, context);
+        std::ofstream stream;
+        if (planar)
+            stream.open(stream_path(output_size).c_str(), std::ios::binary);
+        return ExpandInputFrames(s, context, -1, planar ? &stream : nullptr) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // every worker maps the same table file, decodes its segment from the keyframe before it and
+    // writes its own part.
+    if (!fishcat::WriteRemapTableFile(table_path, context.image_size,
+                                      {context.map_x, context.map_y, context.gain, context.lod}))
         return EXIT_FAILURE;
+    std::vector<std::vector<std::string>> worker_arguments;
+    for (int segment = 0; segment < s.expansion_.workers; segment++)
+        worker_arguments.push_back({"fisheye_expansion", input_settings_file, "--segment",
+                                    std::to_string(segment), std::to_string(s.expansion_.workers)});
+    LOG(INFO) << "Expanding " << s.input_ << " in " << s.expansion_.workers << " segments." << std::endl;
+    bool success = fishcat::RunWorkerProcesses(fishcat::CurrentExecutable(argv[0]), worker_arguments);
+    std::remove(table_path.c_str());
+
+    if (planar)
+    {
+        // the parts are raw frames, appending them in order is the whole stream.
+        std::ofstream stream(stream_path(output_size).c_str(), std::ios::binary);
+        for (int segment = 0; segment < s.expansion_.workers; segment++)
+        {
+            const std::string path = part_path(output_size, segment);
+            std::ifstream part(path.c_str(), std::ios::binary);
+            if (part.peek() != std::ifstream::traits_type::eof())
+                stream << part.rdbuf();
+            part.close();
+            std::remove(path.c_str());
+        }
+        success = success && (bool)stream;
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int RunStereoDepth(int argc, char **argv)
+{
+    fishcat::CalibrationSettings s;
+    const std::string input_settings_file = argc > 1 ? argv[1] : "test.xml";
+
+    if (!ReadCommandSettings(input_settings_file, s))
+        return EXIT_FAILURE;
+
+    // the rectification maps are built with the first frame and reused for the whole input.
+    std::unique_ptr<fishcat::StereoDepthEngine> engine;
+    cv::Mat view, disparity, depth;
+
+    while (s.HasNextImage())
+    {
+        view = s.NextImage();
+        if (view.empty())
+        {
+            LOG(WARNING) << "Image is missing, name of : "
+                         << s.current_image_name_
+                         << std::endl;
+            continue;
+        }
+
+        // the pair is recorded side by side, the left camera in the left half.
+        const int half_width = view.cols / 2;
+        cv::Mat left = view.colRange(0, half_width), right = view.colRange(half_width, 2 * half_width);
+        if (!engine)
+        {
+            fishcat::StereoRig rig;
+            if (!fishcat::ReadStereoRig(s.camera_intrinsic_path_, left.size(), rig))
+                return EXIT_FAILURE;
+            engine.reset(new fishcat::StereoDepthEngine(rig, s.stereo_));
+        }
+
+        engine->Process(left, right, disparity, depth);
+
+        fishcat::LogItem("Saving the disparity and depth of : {0}", s.current_image_name_);
+        std::string name = stringformat::StringTrimExtension(s.current_image_name_);
+        cv::Mat disparity_16u, depth_16u;
+        cv::max(disparity, 0, disparity_16u);
+        disparity_16u.convertTo(disparity_16u, CV_16U);
+        depth.convertTo(depth_16u, CV_16U, s.stereo_.depth_scale);
+        cv::imwrite(s.image_path_ + STRING_FORMAT("disparity_{0}.png", name), disparity_16u);
+        cv::imwrite(s.image_path_ + STRING_FORMAT("depth_{0}.png", name), depth_16u);
     }
 
     return EXIT_SUCCESS;
 }
 
-int RunFisheyeExpansion(int argc, char **argv)
+int RunTargetlessExtrinsic(int argc, char **argv)
 {
-    fishcat::IntrinsicCalibrationHelp();
     fishcat::CalibrationSettings s;
     const std::string input_settings_file = argc > 1 ? argv[1] : "test.xml";
 
-    // reading the input file and checking.
-    cv::FileStorage fs(input_settings_file, cv::FileStorage::READ); // Read the CalibrationSettings
+    if (!ReadCommandSettings(input_settings_file, s))
+        return EXIT_FAILURE;
+
+    // the intrinsics of both cameras, a translation in the file is kept as the nominal lever arm,
+    // else the nominal baseline of the settings places the right center on the left x axis.
+    cv::Mat left_intrinsic, left_coefficients, right_intrinsic, right_coefficients, translation;
+    cv::FileStorage f_camera(s.camera_intrinsic_path_, cv::FileStorage::READ);
+    f_camera["in1_intrinsic"] >> left_intrinsic;
+    f_camera["in1_coff"] >> left_coefficients;
+    f_camera["in2_intrinsic"] >> right_intrinsic;
+    f_camera["in2_coff"] >> right_coefficients;
+    f_camera["translation"] >> translation;
+    f_camera.release();
+    if (left_intrinsic.empty() || left_coefficients.empty() || right_intrinsic.empty() || right_coefficients.empty())
+    {
+        LOG(ERROR) << "The camera file " << s.camera_intrinsic_path_ << " misses one of the two cameras." << std::endl;
+        return EXIT_FAILURE;
+    }
+    const bool nominal_translation = translation.total() == 3 && cv::norm(translation) > 1e-9;
+    if (!nominal_translation && s.targetless_.baseline <= 0)
+    {
+        LOG(ERROR) << "The camera file " << s.camera_intrinsic_path_ << " has no translation and Targetless_Baseline "
+                   << "is not set, the depth needs a nonzero baseline." << std::endl;
+        return EXIT_FAILURE;
+    }
 
+    // the frames hold the two images side by side, as for the stereo depth.
+    std::vector<fishcat::BearingMatch> matches;
+    std::unique_ptr<fishcat::KannalaBrandtModel> left_model, right_model;
+    cv::Mat view, left_gray, right_gray;
+    int frames = 0;
+    while (s.HasNextImage())
+    {
+        view = s.NextImage();
+        if (view.empty())
+        {
+            LOG(WARNING) << "Image is missing, name of : "
+                         << s.current_image_name_
+                         << std::endl;
+            continue;
+        }
+
+        const int half_width = view.cols / 2;
+        cv::cvtColor(view.colRange(0, half_width), left_gray, cv::COLOR_BGR2GRAY);
+        cv::cvtColor(view.colRange(half_width, 2 * half_width), right_gray, cv::COLOR_BGR2GRAY);
+        if (!left_model)
+        {
+            left_model.reset(new fishcat::KannalaBrandtModel(left_intrinsic, left_coefficients,
+                                                             fishcat::FitKBInverseModel(left_intrinsic, left_coefficients, left_gray.size())));
+            right_model.reset(new fishcat::KannalaBrandtModel(right_intrinsic, right_coefficients,
+                                                              fishcat::FitKBInverseModel(right_intrinsic, right_coefficients, right_gray.size())));
+        }
+
+        int number_matches = fishcat::CollectBearingMatches(left_gray, right_gray, *left_model, *right_model,
+                                                            s.targetless_, matches);
+        fishcat::LogItem("{0}: {1} bearing matches.", s.current_image_name_, number_matches);
+        frames++;
+    }
+    fishcat::FlushItemLog();
+
+    fishcat::RotationEstimate estimate;
+    if (!fishcat::EstimateRelativeRotation(matches, s.targetless_, estimate))
+        return EXIT_FAILURE;
+    fishcat::RefineRelativeRotation(matches, s.targetless_, estimate);
+    if (!nominal_translation)
+        translation = cv::Mat(estimate.rotation * cv::Vec3d(-s.targetless_.baseline, 0, 0));
+
+    // the stereo camera file layout, read back by the stereo depth and the stitching.
+    cv::FileStorage f_output(s.output_fileName_, cv::FileStorage::WRITE);
+    if (!f_output.isOpened())
+    {
+        LOG(ERROR) << "Could not write the extrinsics to " << s.output_fileName_ << std::endl;
+        return EXIT_FAILURE;
+    }
+    f_output << "in1_intrinsic" << left_intrinsic;
+    f_output << "in1_coff" << left_coefficients;
+    f_output << "in2_intrinsic" << right_intrinsic;
+    f_output << "in2_coff" << right_coefficients;
+    f_output << "rotation" << cv::Mat(estimate.rotation);
+    f_output << "translation" << translation;
+    f_output << "Targetless_Frames" << frames;
+    f_output << "Targetless_Inliers" << (int)estimate.inliers.size();
+    f_output << "Targetless_RMS_Angle" << estimate.rms_angle;
+    f_output.release();
+
+    LOG(INFO) << "The rig rotation from " << estimate.inliers.size() << " inliers over " << frames
+              << " frames is written to " << s.output_fileName_ << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int RunRemapBenchmark(int argc, char **argv)
+{
+    fishcat::CalibrationSettings s;
+    const std::string input_settings_file = argc > 1 ? argv[1] : "test.xml";
+    const int runs = argc > 2 ? std::max(1, atoi(argv[2])) : 10;
+
+    if (!ReadCommandSettings(input_settings_file, s))
+        return EXIT_FAILURE;
+
+    // the camera as the expansion reads it, from the registry or a camera file.
+    fishcat::CameraRecord camera;
+    if (!fishcat::ReadSettingsCamera(s, camera))
+        return EXIT_FAILURE;
+    fishcat::KBInverseModel inverse_model = camera.inverse_model;
+    fishcat::RemapOutputFormat output_format = fishcat::ParseRemapOutputFormat(s.expansion_.output_format);
+    if (output_format == fishcat::REMAP_UNKNOWN_FORMAT)
+        output_format = fishcat::REMAP_BGR;
+
+    // the first frame is the source of all the runs, the expansion of an 8K fisheye frame is the reference job.
+    cv::Mat view;
+    while (s.HasNextImage() && view.empty())
+        view = s.NextImage();
+    if (view.empty())
+    {
+        LOG(ERROR) << "No input frame to benchmark the remap on." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (camera.model_type == fishcat::KANNALA_BRANDT && inverse_model.coefficients.empty())
+        inverse_model = fishcat::FitKBInverseModel(camera.intrinsic, camera.coefficients, view.size());
+    cv::Mat map_x, map_y, map1, map2;
+    if (!fishcat::BuildExpansionMap(camera.model_type, camera.intrinsic, camera.coefficients, inverse_model,
+                                    s.expansion_, map_x, map_y))
+        return EXIT_FAILURE;
+    cv::convertMaps(map_x, map_y, map1, map2, CV_16SC2);
+    fishcat::RemapTiling tiling;
+    fishcat::BuildRemapTiling(map_x, map_y, view.size(), s.expansion_.tile_size > 0 ? s.expansion_.tile_size : 64, tiling);
+
+    // milliseconds per run, after one warm-up run.
+    auto time_runs = [runs](const std::function<void()> &remap)
+    {
+        remap();
+        int64 start_tick = cv::getTickCount();
+        for (int i = 0; i < runs; i++)
+            remap();
+        return 1000.0 * (cv::getTickCount() - start_tick) / cv::getTickFrequency() / runs;
+    };
+
+    // the fused kernel rejects some inputs, e.g. an odd output size for the 4:2:0 formats.
+    cv::Mat output;
+    if (!fishcat::FusedRemap(view, map_x, map_y, output_format, output) ||
+        !fishcat::FusedRemap(view, map_x, map_y, output_format, output, cv::Mat(), &tiling))
+    {
+        LOG(ERROR) << "The fused remap into " << s.expansion_.output_format << " failed, the benchmark is aborted."
+                   << std::endl;
+        return EXIT_FAILURE;
+    }
+    const double rows_ms = time_runs([&]()
+                                     { cv::remap(view, output, map1, map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT); });
+    const double tiled_ms = time_runs([&]()
+                                      { fishcat::TiledRemap(view, map1, map2, tiling, output); });
+    const double fused_rows_ms = time_runs([&]()
+                                           { fishcat::FusedRemap(view, map_x, map_y, output_format, output); });
+    const double fused_tiled_ms = time_runs([&]()
+                                            { fishcat::FusedRemap(view, map_x, map_y, output_format, output, cv::Mat(), &tiling); });
+
+    LOG(INFO) << "Remap of " << view.cols << "x" << view.rows << " into " << map_x.cols << "x" << map_x.rows
+              << " over " << tiling.tiles.size() << " tiles, " << runs << " runs:" << std::endl;
+    LOG(INFO) << std::fixed << std::setprecision(2)
+              << "  cv::remap     rows " << rows_ms << " ms, tiled " << tiled_ms << " ms, speedup "
+              << rows_ms / tiled_ms << std::endl;
+    LOG(INFO) << std::fixed << std::setprecision(2)
+              << "  fused " << s.expansion_.output_format << " rows " << fused_rows_ms << " ms, tiled " << fused_tiled_ms
+              << " ms, speedup " << fused_rows_ms / fused_tiled_ms << std::endl;
+
+    return EXIT_SUCCESS;
+}
+
+// Reads the registry records back, e.g. to rewrite the registry with a changed record.
+bool ReadRegistryRecords(const std::string &registry_file, std::vector<fishcat::CameraRecord> &cameras)
+{
+    fishcat::CameraRegistry registry;
+    if (!registry.Open(registry_file))
+        return false;
+    cameras.resize(registry.Count());
+    for (int index = 0; index < registry.Count(); index++)
+        registry.Record(index, cameras[index]);
+    return true;
+}
+
+// camera_registry import registry.bin camera files or lists...
+// camera_registry export registry.bin list.yml
+// camera_registry link settings.xml, precomputes the expansion tables of the Camera_RegistryId camera.
+int RunCameraRegistry(int argc, char **argv)
+{
+    const std::string action = argc > 2 ? argv[1] : "";
+    if (action == "import" && argc > 3)
+    {
+        std::vector<fishcat::CameraRecord> cameras;
+        for (int i = 3; i < argc; i++)
+            if (!fishcat::ReadCameraList(argv[i], cameras))
+                return EXIT_FAILURE;
+        if (!fishcat::WriteCameraRegistry(argv[2], cameras))
+            return EXIT_FAILURE;
+        LOG(INFO) << cameras.size() << " cameras are written to the registry " << argv[2] << std::endl;
+        return EXIT_SUCCESS;
+    }
+    if (action == "export" && argc > 3)
+    {
+        std::vector<fishcat::CameraRecord> cameras;
+        return ReadRegistryRecords(argv[2], cameras) && fishcat::WriteCameraList(argv[3], cameras) ? EXIT_SUCCESS
+                                                                                                   : EXIT_FAILURE;
+    }
+    if (action != "link")
+    {
+        LOG(ERROR) << "Usage: camera_registry import registry.bin cameras..., camera_registry export registry.bin "
+                      "list.yml or camera_registry link settings.xml"
+                   << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // the expansion settings and the registry camera come from the settings, no input is needed.
+    fishcat::CalibrationSettings s;
+    cv::FileStorage fs(argv[2], cv::FileStorage::READ);
     if (!fs.isOpened())
     {
         LOG(ERROR) << "Could not open the configuration file: \""
-                   << input_settings_file
+                   << argv[2]
                    << "\""
                    << std::endl;
         return EXIT_FAILURE;
     }
-
-    // from the setting in the xml file.
     fs["Settings"] >> s;
-    fs.release(); // close CalibrationSettings file
+    fs.release();
+    if (s.camera_registry_.empty())
+    {
+        LOG(ERROR) << "Linking remap tables needs Camera_Registry and Camera_RegistryId in the settings." << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    if (!s.good_input_)
+    ExpansionContext context;
+    if (!ReadExpansionContext(s, context))
+        return EXIT_FAILURE;
+    if (context.camera.image_size.area() == 0)
     {
-        LOG(ERROR) << "Invalid input detected. Application stopping. "
+        LOG(ERROR) << "The camera " << context.camera.id << " has no image size to build its tables for." << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string table_path = s.image_path_ + STRING_FORMAT("remap_tables_{0}_v{1}.bin", context.camera.id,
+                                                                 context.camera.version);
+    if (!BuildExpansionTables(s, context.camera.image_size, context) ||
+        !fishcat::WriteRemapTableFile(table_path, context.image_size,
+                                      {context.map_x, context.map_y, context.gain, context.lod}))
+        return EXIT_FAILURE;
+
+    // the registry is read-only once written, it is rewritten with the linked record and swapped in.
+    std::vector<fishcat::CameraRecord> cameras;
+    if (!ReadRegistryRecords(s.camera_registry_, cameras))
+        return EXIT_FAILURE;
+    for (fishcat::CameraRecord &camera : cameras)
+    {
+        if (camera.id == context.camera.id && camera.version == context.camera.version)
+        {
+            camera.remap_tables = table_path;
+            camera.remap_key = ExpansionTablesKey(s.expansion_);
+        }
+    }
+    const std::string temporary_file = s.camera_registry_ + ".tmp";
+    if (!fishcat::WriteCameraRegistry(temporary_file, cameras) ||
+        std::rename(temporary_file.c_str(), s.camera_registry_.c_str()) != 0)
+    {
+        LOG(ERROR) << "Could not update the camera registry " << s.camera_registry_ << std::endl;
+        return EXIT_FAILURE;
+    }
+    LOG(INFO) << "The camera " << context.camera.id << " version " << context.camera.version << " links the tables "
+              << table_path << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// One job of the batch manifest, run in process by its command.
+struct BatchJob
+{
+    std::string name;
+    std::string command;
+    std::string settings;
+    std::vector<std::string> arguments; // after the settings file.
+    std::vector<std::string> after;     // names of the jobs it waits for.
+    command_func_t func;
+    int exit_code = -1; // -1 if it did not return.
+};
+
+std::vector<std::string> SplitWords(const std::string &text)
+{
+    std::istringstream stream(text);
+    std::vector<std::string> words;
+    std::string word;
+    while (stream >> word)
+        words.push_back(word);
+    return words;
+}
+
+int RunBatch(int argc, char **argv, const std::vector<std::pair<std::string, command_func_t>> &commands)
+{
+    const std::string manifest_file = argc > 1 ? argv[1] : "batch.yml";
+    cv::FileStorage fs(manifest_file, cv::FileStorage::READ);
+    if (!fs.isOpened())
+    {
+        LOG(ERROR) << "Could not open the batch manifest: \""
+                   << manifest_file
+                   << "\""
                    << std::endl;
         return EXIT_FAILURE;
     }
 
-    cv::Mat fisheye_intrinsic, fisheye_distortion_coeff;
-    cv::FileStorage f_camera(s.camera_intrinsic_path_, cv::FileStorage::READ);
-    f_camera["in1_intrinsic"] >> fisheye_intrinsic;
-    f_camera["in1_coff"] >> fisheye_distortion_coeff;
-    f_camera.release();
+    int workers, threads_per_job;
+    std::string report_file;
+    cv::read(fs["Batch_Workers"], workers, 0);
+    cv::read(fs["Batch_ThreadsPerJob"], threads_per_job, 0);
+    cv::read(fs["Batch_Report"], report_file, stringformat::StringTrimExtension(manifest_file) + "_report.yml");
 
-    cv::Mat view;
+    std::vector<BatchJob> jobs;
+    std::map<std::string, int> job_of_name;
+    const cv::FileNode job_nodes = fs["Jobs"];
+    for (cv::FileNodeIterator it = job_nodes.begin(); it != job_nodes.end(); ++it)
+    {
+        const cv::FileNode node = *it;
+        BatchJob job;
+        std::string arguments, after;
+        cv::read(node["Command"], job.command, std::string());
+        cv::read(node["Settings"], job.settings, std::string());
+        cv::read(node["Name"], job.name, job.settings);
+        cv::read(node["Arguments"], arguments, std::string());
+        cv::read(node["After"], after, std::string());
+        job.arguments = SplitWords(arguments);
+        job.after = SplitWords(after);
+
+        // a batch does not nest, and a job only waits for the jobs listed before it.
+        for (const auto &command : commands)
+            if (command.first == job.command && command.first != "batch")
+                job.func = command.second;
+        if (!job.func)
+        {
+            LOG(ERROR) << "Unknown command \"" << job.command << "\" of the batch job " << job.name << std::endl;
+            return EXIT_FAILURE;
+        }
+        for (const std::string &name : job.after)
+        {
+            if (job_of_name.count(name) == 0)
+            {
+                LOG(ERROR) << "The batch job " << job.name << " waits for " << name << ", which is not listed before it."
+                           << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        if (job_of_name.count(job.name) != 0)
+        {
+            LOG(ERROR) << "The batch job name " << job.name << " is listed twice." << std::endl;
+            return EXIT_FAILURE;
+        }
+        job_of_name[job.name] = (int)jobs.size();
+        jobs.push_back(job);
+    }
+    fs.release();
+    if (jobs.empty())
+    {
+        LOG(ERROR) << "No job in the batch manifest " << manifest_file << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    for (int image_index = 0; image_index < s.image_list_.size(); image_index++)
+    // about twice the cores are kept busy, so the cores of a job decoding or writing its files are
+    // taken by the compute of the others.
+    const int cpus = cv::getNumberOfCPUs();
+    if (workers <= 0)
+        workers = std::max(1, cpus / 2);
+    workers = std::min(workers, (int)jobs.size());
+    if (threads_per_job <= 0)
+        threads_per_job = std::max(1, 2 * cpus / workers);
+
+    fishcat::JobScheduler scheduler;
+    for (int index = 0; index < (int)jobs.size(); index++)
     {
-        view = s.NextImage();
-        fishcat::FisheyeExpansion(view, fisheye_intrinsic, fisheye_distortion_coeff);
+        std::vector<int> dependencies;
+        for (const std::string &name : jobs[index].after)
+            dependencies.push_back(job_of_name[name]);
+        scheduler.AddJob([&jobs, index, argv]()
+                         {
+                             BatchJob &job = jobs[index];
+                             std::vector<std::string> arguments = {argv[0], job.settings};
+                             arguments.insert(arguments.end(), job.arguments.begin(), job.arguments.end());
+                             std::vector<char *> job_argv;
+                             for (std::string &argument : arguments)
+                                 job_argv.push_back(&argument[0]);
+                             job_argv.push_back(nullptr);
+                             job.exit_code = job.func((int)arguments.size(), job_argv.data());
+                             return job.exit_code == EXIT_SUCCESS; },
+                         dependencies);
     }
 
-    return EXIT_SUCCESS;
+    LOG(INFO) << "Running " << jobs.size() << " jobs on " << workers << " workers of " << threads_per_job
+              << " threads." << std::endl;
+    const int64 start_tick = cv::getTickCount();
+    // the OpenMP thread count is per thread, the OpenCV pool is shared by all the jobs.
+    scheduler.Run(workers, [threads_per_job](int)
+                  {
+#ifdef _USE_OPENMP
+                      omp_set_num_threads(threads_per_job);
+#endif
+                  });
+    const double wall_seconds = (cv::getTickCount() - start_tick) / cv::getTickFrequency();
+
+    const char *state_names[] = {"PENDING", "SUCCEEDED", "FAILED", "SKIPPED"};
+    int state_counts[4] = {0, 0, 0, 0};
+    double job_seconds = 0;
+    cv::FileStorage report(report_file, cv::FileStorage::WRITE);
+    report << "Batch_Manifest" << manifest_file;
+    report << "Batch_Workers" << workers;
+    report << "Batch_ThreadsPerJob" << threads_per_job;
+    report << "Jobs"
+           << "[";
+    for (int index = 0; index < (int)jobs.size(); index++)
+    {
+        const fishcat::JobScheduler::JobState state = scheduler.State(index);
+        state_counts[state]++;
+        job_seconds += scheduler.Seconds(index);
+        report << "{"
+               << "Name" << jobs[index].name
+               << "Command" << jobs[index].command
+               << "Settings" << jobs[index].settings
+               << "State" << state_names[state]
+               << "Exit_Code" << jobs[index].exit_code
+               << "Seconds" << scheduler.Seconds(index)
+               << "}";
+    }
+    report << "]";
+    report << "Succeeded" << state_counts[fishcat::JobScheduler::JOB_SUCCEEDED];
+    report << "Failed" << state_counts[fishcat::JobScheduler::JOB_FAILED];
+    report << "Skipped" << state_counts[fishcat::JobScheduler::JOB_SKIPPED];
+    report << "Wall_Seconds" << wall_seconds;
+    report << "Job_Seconds" << job_seconds;
+    report.release();
+
+    LOG(INFO) << state_counts[fishcat::JobScheduler::JOB_SUCCEEDED] << " of " << jobs.size() << " jobs succeeded, "
+              << state_counts[fishcat::JobScheduler::JOB_FAILED] << " failed and "
+              << state_counts[fishcat::JobScheduler::JOB_SKIPPED] << " were skipped in " << wall_seconds
+              << " s (" << job_seconds << " s of job time), see " << report_file << std::endl;
+    return state_counts[fishcat::JobScheduler::JOB_SUCCEEDED] == (int)jobs.size() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char **argv)
@@ -297,6 +1184,12 @@ int main(int argc, char **argv)
     commands.emplace_back("intrinsic_calibration", &RunIntrinsicCalibration);
     commands.emplace_back("panoramic_stitching", &RunPanoramicStitching);
     commands.emplace_back("fisheye_expansion", &RunFisheyeExpansion);
+    commands.emplace_back("stereo_depth", &RunStereoDepth);
+    commands.emplace_back("targetless_extrinsic", &RunTargetlessExtrinsic);
+    commands.emplace_back("remap_benchmark", &RunRemapBenchmark);
+    commands.emplace_back("camera_registry", &RunCameraRegistry);
+    commands.emplace_back("batch", [&commands](int command_argc, char **command_argv)
+                          { return RunBatch(command_argc, command_argv, commands); });
 
     if (argc == 1)
     {
@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+#include "base/log.h"
+#include "panoramic_process/fused_remap.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        // bilinear gather of one pixel as b, g, r scaled by gain, out of image pixels count as black like cv::remap.
+        template <int Channels>
+        inline void Sample(const cv::Mat &src, float x, float y, float gain, float *bgr)
+        {
+            bgr[0] = bgr[1] = bgr[2] = 0;
+            if (x < -1 || y < -1 || x >= src.cols || y >= src.rows)
+                return;
+
+            const int x0 = cvFloor(x), y0 = cvFloor(y);
+            const float ax = x - x0, ay = y - y0;
+            const float weights[4] = {gain * (1 - ax) * (1 - ay), gain * ax * (1 - ay), gain * (1 - ax) * ay, gain * ax * ay};
+            for (int i = 0; i < 4; i++)
+            {
+                const int xi = x0 + (i & 1), yi = y0 + (i >> 1);
+                if (xi < 0 || yi < 0 || xi >= src.cols || yi >= src.rows)
+                    continue;
+                const uchar *pixel = src.ptr<uchar>(yi) + Channels * xi;
+                for (int c = 0; c < 3; c++)
+                    bgr[c] += weights[i] * pixel[Channels == 3 ? c : 0];
+            }
+        }
+
+        // BT.601 full range, as cv::COLOR_BGR2GRAY.
+        inline uchar Gray(const float *bgr)
+        {
+            return cv::saturate_cast<uchar>(0.299f * bgr[2] + 0.587f * bgr[1] + 0.114f * bgr[0]);
+        }
+
+        // BT.601 limited range, as cv::COLOR_BGR2YUV_I420.
+        inline uchar Luma(const float *bgr)
+        {
+            return cv::saturate_cast<uchar>(16 + 0.257f * bgr[2] + 0.504f * bgr[1] + 0.098f * bgr[0]);
+        }
+
+        inline uchar ChromaU(const float *bgr)
+        {
+            return cv::saturate_cast<uchar>(128 - 0.148f * bgr[2] - 0.291f * bgr[1] + 0.439f * bgr[0]);
+        }
+
+        inline uchar ChromaV(const float *bgr)
+        {
+            return cv::saturate_cast<uchar>(128 + 0.439f * bgr[2] - 0.368f * bgr[1] - 0.071f * bgr[0]);
+        }
+
+        template <int Channels>
+        struct BilinearSampler
+        {
+            const cv::Mat &src;
+
+            const cv::Mat &Source() const { return src; }
+            void operator()(float x, float y, float, float gain, float *bgr) const
+            {
+                Sample<Channels>(src, x, y, gain, bgr);
+            }
+        };
+
+        // trilinear gather between the two pyramid levels around the lod, the coordinates are the ones
+        // of level 0 and a pixel of level l covers 2^l x 2^l pixels of it.
+        template <int Channels>
+        struct MipmapSampler
+        {
+            const std::vector<cv::Mat> &pyramid;
+
+            const cv::Mat &Source() const { return pyramid[0]; }
+            void operator()(float x, float y, float lod, float gain, float *bgr) const
+            {
+                const cv::Mat &base = pyramid[0];
+                if (x < -1 || y < -1 || x >= base.cols || y >= base.rows)
+                {
+                    bgr[0] = bgr[1] = bgr[2] = 0;
+                    return;
+                }
+
+                const int top = (int)pyramid.size() - 1;
+                lod = std::min(std::max(lod, 0.f), (float)top);
+                const int level = std::min((int)lod, top);
+                const float blend = lod - level;
+                float scale = 1.f / (1 << level);
+                Sample<Channels>(pyramid[level], (x + 0.5f) * scale - 0.5f, (y + 0.5f) * scale - 0.5f,
+                                 gain * (1 - blend), bgr);
+                if (blend <= 0 || level == top)
+                    return;
+
+                float upper[3];
+                scale *= 0.5f;
+                Sample<Channels>(pyramid[level + 1], (x + 0.5f) * scale - 0.5f, (y + 0.5f) * scale - 0.5f,
+                                 gain * blend, upper);
+                for (int c = 0; c < 3; c++)
+                    bgr[c] += upper[c];
+            }
+        };
+
+        const int kTilesPerTask = 8;        // consecutive tiles taken by a thread at once, so it keeps the locality.
+        const int kCacheLine = 64;          // bytes.
+        const int kMaxPrefetchArea = 16384; // larger footprints (around the poles) are not worth prefetching.
+        const int kMaxPyramidLevels = 8;    // footprints past 128 source pixels are sampled at the top level.
+
+        // interleaves the bits of x and y.
+        inline uint64_t MortonCode(uint32_t x, uint32_t y)
+        {
+            uint64_t code = 0;
+            for (int bit = 0; bit < 32; bit++)
+                code |= ((uint64_t)((x >> bit) & 1) << (2 * bit)) | ((uint64_t)((y >> bit) & 1) << (2 * bit + 1));
+            return code;
+        }
+
+        // touches the source lines of the next tile, so its gather starts on warm cache lines.
+        inline void PrefetchSource(const cv::Mat &src, const cv::Rect &bounds)
+        {
+#if defined(__GNUC__)
+            if (bounds.area() == 0 || bounds.area() > kMaxPrefetchArea)
+                return;
+            const int row_bytes = bounds.width * (int)src.elemSize();
+            for (int row = bounds.y; row < bounds.y + bounds.height; row++)
+            {
+                const uchar *line = src.ptr<uchar>(row) + bounds.x * src.elemSize();
+                for (int offset = 0; offset < row_bytes; offset += kCacheLine)
+                    __builtin_prefetch(line + offset);
+            }
+#endif
+        }
+
+        template <typename Sampler>
+        void RemapPacked(const Sampler &sample, const cv::Mat &map_x, const cv::Mat &map_y, const cv::Mat &lod,
+                         const cv::Mat &gain, RemapOutputFormat format, const cv::Rect &region, cv::Mat &dst)
+        {
+            float bgr[3];
+            for (int row = region.y; row < region.y + region.height; row++)
+            {
+                const float *map_x_row = map_x.ptr<float>(row);
+                const float *map_y_row = map_y.ptr<float>(row);
+                const float *lod_row = lod.empty() ? nullptr : lod.ptr<float>(row);
+                const float *gain_row = gain.empty() ? nullptr : gain.ptr<float>(row);
+                uchar *dst_row = dst.ptr<uchar>(row);
+                for (int col = region.x; col < region.x + region.width; col++)
+                {
+                    sample(map_x_row[col], map_y_row[col], lod_row ? lod_row[col] : 0.f, gain_row ? gain_row[col] : 1.f, bgr);
+                    if (format == REMAP_GRAY)
+                    {
+                        dst_row[col] = Gray(bgr);
+                        continue;
+                    }
+                    for (int c = 0; c < 3; c++)
+                        dst_row[3 * col + c] = cv::saturate_cast<uchar>(bgr[c]);
+                }
+            }
+        }
+
+        // each pair of rows writes its two luma rows and one chroma row, the chroma is the 2x2 mean.
+        // The region has an even origin and size.
+        template <typename Sampler>
+        void RemapYUV420(const Sampler &sample, const cv::Mat &map_x, const cv::Mat &map_y, const cv::Mat &lod,
+                         const cv::Mat &gain, RemapOutputFormat format, const cv::Rect &region, cv::Mat &dst)
+        {
+            const int width = map_x.cols, height = map_x.rows;
+            uchar *chroma_plane = dst.ptr<uchar>(height);
+            const int quarter = width * height / 4;
+
+            float bgr[3], mean[3];
+            for (int pair = region.y / 2; pair < (region.y + region.height) / 2; pair++)
+            {
+                uchar *luma_rows[2] = {dst.ptr<uchar>(2 * pair), dst.ptr<uchar>(2 * pair + 1)};
+                uchar *u_row = format == REMAP_NV12 ? chroma_plane + pair * width : chroma_plane + pair * (width / 2);
+                uchar *v_row = u_row + quarter;
+                for (int col = region.x; col < region.x + region.width; col += 2)
+                {
+                    mean[0] = mean[1] = mean[2] = 0;
+                    for (int i = 0; i < 4; i++)
+                    {
+                        const int row = 2 * pair + (i >> 1), x = col + (i & 1);
+                        sample(map_x.ptr<float>(row)[x], map_y.ptr<float>(row)[x], lod.empty() ? 0.f : lod.ptr<float>(row)[x],
+                               gain.empty() ? 1.f : gain.ptr<float>(row)[x], bgr);
+                        luma_rows[i >> 1][x] = Luma(bgr);
+                        for (int c = 0; c < 3; c++)
+                            mean[c] += 0.25f * bgr[c];
+                    }
+                    if (format == REMAP_NV12)
+                    {
+                        u_row[col] = ChromaU(mean);
+                        u_row[col + 1] = ChromaV(mean);
+                    }
+                    else
+                    {
+                        u_row[col / 2] = ChromaU(mean);
+                        v_row[col / 2] = ChromaV(mean);
+                    }
+                }
+            }
+        }
+
+        template <typename Sampler>
+        void RemapRegion(const Sampler &sample, const cv::Mat &map_x, const cv::Mat &map_y, const cv::Mat &lod,
+                         const cv::Mat &gain, RemapOutputFormat format, const cv::Rect &region, cv::Mat &dst)
+        {
+            if (format == REMAP_YUV_I420 || format == REMAP_NV12)
+                RemapYUV420(sample, map_x, map_y, lod, gain, format, region, dst);
+            else
+                RemapPacked(sample, map_x, map_y, lod, gain, format, region, dst);
+        }
+
+        template <typename Sampler>
+        void RunFusedRemap(const Sampler &sample, const cv::Mat &map_x, const cv::Mat &map_y, const cv::Mat &lod,
+                           const cv::Mat &gain, RemapOutputFormat format, const RemapTiling *tiling, cv::Mat &dst)
+        {
+            if (tiling)
+            {
+                const int tile_count = (int)tiling->tiles.size();
+#pragma omp parallel for schedule(dynamic, kTilesPerTask)
+                for (int i = 0; i < tile_count; i++)
+                {
+                    if (i + 1 < tile_count)
+                        PrefetchSource(sample.Source(), tiling->source_bounds[i + 1]);
+                    RemapRegion(sample, map_x, map_y, lod, gain, format, tiling->tiles[i], dst);
+                }
+                return;
+            }
+
+            // row-major walk, by pairs of rows for the 4:2:0 formats.
+            const int band = format == REMAP_YUV_I420 || format == REMAP_NV12 ? 2 : 1;
+#pragma omp parallel for
+            for (int band_index = 0; band_index < map_x.rows / band; band_index++)
+            {
+                RemapRegion(sample, map_x, map_y, lod, gain, format, cv::Rect(0, band_index * band, map_x.cols, band), dst);
+            }
+        }
+
+        // checks the inputs of a fused remap and allocates its output.
+        bool PrepareFusedRemap(const cv::Mat &src, const cv::Mat &map_x, const cv::Mat &map_y, RemapOutputFormat format,
+                               const cv::Mat &gain, const RemapTiling *tiling, cv::Mat &dst)
+        {
+            if (src.depth() != CV_8U || (src.channels() != 1 && src.channels() != 3))
+            {
+                LOG(ERROR) << "The fused remap only takes 8-bit gray or BGR images." << std::endl;
+                return false;
+            }
+            if (map_x.type() != CV_32FC1 || map_y.type() != CV_32FC1 || map_x.size() != map_y.size())
+            {
+                LOG(ERROR) << "The fused remap takes a pair of CV_32FC1 tables of the same size." << std::endl;
+                return false;
+            }
+            if (!gain.empty() && (gain.type() != CV_32FC1 || gain.size() != map_x.size()))
+            {
+                LOG(ERROR) << "The remap gain should be a CV_32FC1 table of the map size." << std::endl;
+                return false;
+            }
+
+            if (tiling && tiling->output_size != map_x.size())
+            {
+                LOG(ERROR) << "The remap tiling was built for another table size." << std::endl;
+                return false;
+            }
+
+            switch (format)
+            {
+            case REMAP_BGR:
+            case REMAP_GRAY:
+                dst.create(map_x.size(), format == REMAP_BGR ? CV_8UC3 : CV_8UC1);
+                break;
+            case REMAP_YUV_I420:
+            case REMAP_NV12:
+                if (map_x.cols % 2 || map_x.rows % 2)
+                {
+                    LOG(ERROR) << "The 4:2:0 output needs an even size, got " << map_x.cols << "x" << map_x.rows << std::endl;
+                    return false;
+                }
+                dst.create(map_x.rows * 3 / 2, map_x.cols, CV_8UC1);
+                break;
+            default:
+                LOG(ERROR) << "Unknown remap output format." << std::endl;
+                return false;
+            }
+            return true;
+        }
+    }
+
+    RemapOutputFormat ParseRemapOutputFormat(const std::string &name)
+    {
+        if (name == "BGR" || name.empty())
+            return REMAP_BGR;
+        if (name == "GRAY")
+            return REMAP_GRAY;
+        if (name == "I420")
+            return REMAP_YUV_I420;
+        if (name == "NV12")
+            return REMAP_NV12;
+        return REMAP_UNKNOWN_FORMAT;
+    }
+
+    void DownscaleRemapTable(const cv::Mat &map_x, const cv::Mat &map_y, int factor,
+                             cv::Mat &scaled_map_x, cv::Mat &scaled_map_y)
+    {
+        const cv::Size scaled_size(map_x.cols / factor, map_x.rows / factor);
+        scaled_map_x.create(scaled_size, CV_32FC1);
+        scaled_map_y.create(scaled_size, CV_32FC1);
+        const float area = (float)(factor * factor);
+
+#pragma omp parallel for
+        for (int row = 0; row < scaled_size.height; row++)
+        {
+            float *scaled_x_row = scaled_map_x.ptr<float>(row);
+            float *scaled_y_row = scaled_map_y.ptr<float>(row);
+            for (int col = 0; col < scaled_size.width; col++)
+            {
+                float sum_x = 0, sum_y = 0;
+                bool valid = true;
+                for (int dy = 0; dy < factor && valid; dy++)
+                {
+                    const float *map_x_row = map_x.ptr<float>(row * factor + dy) + col * factor;
+                    const float *map_y_row = map_y.ptr<float>(row * factor + dy) + col * factor;
+                    for (int dx = 0; dx < factor; dx++)
+                    {
+                        valid = valid && map_x_row[dx] >= 0 && map_y_row[dx] >= 0;
+                        sum_x += map_x_row[dx];
+                        sum_y += map_y_row[dx];
+                    }
+                }
+                scaled_x_row[col] = valid ? sum_x / area : -1;
+                scaled_y_row[col] = valid ? sum_y / area : -1;
+            }
+        }
+    }
+
+    void BuildRemapTiling(const cv::Mat &map_x, const cv::Mat &map_y, const cv::Size &source_size,
+                          int tile_size, RemapTiling &tiling)
+    {
+        tile_size = std::max(2, tile_size + tile_size % 2);
+        const int tiles_x = (map_x.cols + tile_size - 1) / tile_size, tiles_y = (map_x.rows + tile_size - 1) / tile_size;
+        std::vector<cv::Rect> tiles(tiles_x * tiles_y), bounds(tiles_x * tiles_y);
+        std::vector<uint64_t> codes(tiles_x * tiles_y);
+        const cv::Rect source_rect(cv::Point(0, 0), source_size);
+
+#pragma omp parallel for
+        for (int index = 0; index < tiles_x * tiles_y; index++)
+        {
+            const cv::Rect tile = cv::Rect((index % tiles_x) * tile_size, (index / tiles_x) * tile_size, tile_size, tile_size) &
+                                  cv::Rect(0, 0, map_x.cols, map_x.rows);
+            float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+            for (int row = tile.y; row < tile.y + tile.height; row++)
+            {
+                const float *map_x_row = map_x.ptr<float>(row);
+                const float *map_y_row = map_y.ptr<float>(row);
+                for (int col = tile.x; col < tile.x + tile.width; col++)
+                {
+                    if (map_x_row[col] < 0 || map_y_row[col] < 0)
+                        continue;
+                    min_x = std::min(min_x, map_x_row[col]);
+                    max_x = std::max(max_x, map_x_row[col]);
+                    min_y = std::min(min_y, map_y_row[col]);
+                    max_y = std::max(max_y, map_y_row[col]);
+                }
+            }
+
+            tiles[index] = tile;
+            if (min_x > max_x)
+            {
+                // nothing to read, the black tiles go last.
+                bounds[index] = cv::Rect();
+                codes[index] = UINT64_MAX;
+                continue;
+            }
+            // the bilinear footprint reaches one pixel past the sampled positions.
+            bounds[index] = cv::Rect(cv::Point(cvFloor(min_x), cvFloor(min_y)), cv::Point(cvFloor(max_x) + 2, cvFloor(max_y) + 2)) &
+                            source_rect;
+            const cv::Point center((bounds[index].x + bounds[index].width / 2) / tile_size,
+                                   (bounds[index].y + bounds[index].height / 2) / tile_size);
+            codes[index] = MortonCode(center.x, center.y);
+        }
+
+        std::vector<int> order(tiles.size());
+        for (int i = 0; i < (int)order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&codes](int a, int b)
+                         { return codes[a] < codes[b]; });
+
+        tiling.output_size = map_x.size();
+        tiling.tiles.resize(order.size());
+        tiling.source_bounds.resize(order.size());
+        for (int i = 0; i < (int)order.size(); i++)
+        {
+            tiling.tiles[i] = tiles[order[i]];
+            tiling.source_bounds[i] = bounds[order[i]];
+        }
+    }
+
+    void TiledRemap(const cv::Mat &src, const cv::Mat &map1, const cv::Mat &map2, const RemapTiling &tiling,
+                    cv::Mat &dst, int interpolation)
+    {
+        if (tiling.output_size != map1.size())
+        {
+            LOG(WARNING) << "The remap tiling was built for another table size, remapping by rows." << std::endl;
+            cv::remap(src, dst, map1, map2, interpolation, cv::BORDER_CONSTANT);
+            return;
+        }
+
+        dst.create(map1.size(), src.type());
+        const int tile_count = (int)tiling.tiles.size();
+        const int tasks = (tile_count + kTilesPerTask - 1) / kTilesPerTask;
+
+        // the tasks run on the OpenCV pool, so the cv::remap of a tile runs serially in its task instead of
+        // dispatching its own parallel loop over a few rows.
+        cv::parallel_for_(cv::Range(0, tasks), [&](const cv::Range &range)
+                          {
+                              const int end = std::min(tile_count, range.end * kTilesPerTask);
+                              for (int i = range.start * kTilesPerTask; i < end; i++)
+                              {
+                                  if (i + 1 < end)
+                                      PrefetchSource(src, tiling.source_bounds[i + 1]);
+                                  const cv::Rect &tile = tiling.tiles[i];
+                                  cv::Mat dst_tile = dst(tile);
+                                  cv::remap(src, dst_tile, map1(tile), map2.empty() ? cv::Mat() : map2(tile), interpolation,
+                                            cv::BORDER_CONSTANT);
+                              }
+                          },
+                          tasks);
+    }
+
+    bool FusedRemap(const cv::Mat &src, const cv::Mat &map_x, const cv::Mat &map_y,
+                    RemapOutputFormat format, cv::Mat &dst, const cv::Mat &gain, const RemapTiling *tiling)
+    {
+        if (!PrepareFusedRemap(src, map_x, map_y, format, gain, tiling, dst))
+            return false;
+
+        if (src.channels() == 3)
+            RunFusedRemap(BilinearSampler<3>{src}, map_x, map_y, cv::Mat(), gain, format, tiling, dst);
+        else
+            RunFusedRemap(BilinearSampler<1>{src}, map_x, map_y, cv::Mat(), gain, format, tiling, dst);
+        return true;
+    }
+
+    void BuildRemapLod(const cv::Mat &map_x, const cv::Mat &map_y, cv::Mat &lod)
+    {
+        lod.create(map_x.size(), CV_32FC1);
+        auto valid = [&map_x, &map_y](int row, int col)
+        {
+            return row >= 0 && col >= 0 && row < map_x.rows && col < map_x.cols &&
+                   map_x.ptr<float>(row)[col] >= 0 && map_y.ptr<float>(row)[col] >= 0;
+        };
+        // source step of a unit output step from (row, col), central where both neighbours are valid.
+        auto step = [&map_x, &map_y, &valid](int row, int col, int d_row, int d_col)
+        {
+            const bool forward = valid(row + d_row, col + d_col), backward = valid(row - d_row, col - d_col);
+            if (!forward && !backward)
+                return 0.f;
+            const int r1 = forward ? row + d_row : row, c1 = forward ? col + d_col : col;
+            const int r0 = backward ? row - d_row : row, c0 = backward ? col - d_col : col;
+            const float span = (float)((forward ? 1 : 0) + (backward ? 1 : 0));
+            const float dx = (map_x.ptr<float>(r1)[c1] - map_x.ptr<float>(r0)[c0]) / span;
+            const float dy = (map_y.ptr<float>(r1)[c1] - map_y.ptr<float>(r0)[c0]) / span;
+            return std::sqrt(dx * dx + dy * dy);
+        };
+
+#pragma omp parallel for
+        for (int row = 0; row < map_x.rows; row++)
+        {
+            float *lod_row = lod.ptr<float>(row);
+            for (int col = 0; col < map_x.cols; col++)
+            {
+                if (!valid(row, col))
+                {
+                    lod_row[col] = 0;
+                    continue;
+                }
+                // the longer axis of the footprint, as the usual isotropic mip-map selection.
+                const float footprint = std::max(step(row, col, 0, 1), step(row, col, 1, 0));
+                lod_row[col] = footprint > 1 ? std::log2(footprint) : 0.f;
+            }
+        }
+    }
+
+    void BuildRemapPyramid(const cv::Mat &src, const cv::Mat &lod, std::vector<cv::Mat> &pyramid)
+    {
+        double max_lod = 0;
+        if (!lod.empty())
+            cv::minMaxLoc(lod, nullptr, &max_lod);
+        const int levels = std::min(kMaxPyramidLevels, 1 + (int)std::ceil(max_lod));
+
+        pyramid.resize(1);
+        pyramid[0] = src;
+        while ((int)pyramid.size() < levels && pyramid.back().cols > 1 && pyramid.back().rows > 1)
+        {
+            cv::Mat level;
+            cv::pyrDown(pyramid.back(), level);
+            pyramid.push_back(level);
+        }
+    }
+
+    bool FusedRemap(const std::vector<cv::Mat> &pyramid, const cv::Mat &map_x, const cv::Mat &map_y, const cv::Mat &lod,
+                    RemapOutputFormat format, cv::Mat &dst, const cv::Mat &gain, const RemapTiling *tiling)
+    {
+        if (pyramid.empty())
+        {
+            LOG(ERROR) << "The mip-mapped remap needs a source pyramid." << std::endl;
+            return false;
+        }
+        if (lod.type() != CV_32FC1 || lod.size() != map_x.size())
+        {
+            LOG(ERROR) << "The level of detail should be a CV_32FC1 table of the map size." << std::endl;
+            return false;
+        }
+        if (!PrepareFusedRemap(pyramid[0], map_x, map_y, format, gain, tiling, dst))
+            return false;
+
+        if (pyramid[0].channels() == 3)
+            RunFusedRemap(MipmapSampler<3>{pyramid}, map_x, map_y, lod, gain, format, tiling, dst);
+        else
+            RunFusedRemap(MipmapSampler<1>{pyramid}, map_x, map_y, lod, gain, format, tiling, dst);
+        return true;
+    }
+}
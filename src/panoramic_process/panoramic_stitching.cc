@@ -10,104 +10,43 @@ namespace fishcat
     {
     }
 
-    void FisheyeExpansion(cv::Mat fisheye_image, cv::Mat intrinsic, cv::Mat distortion_coefficient)
+    cv::Mat ExpansionRotation(const ExpansionSettings &settings)
     {
-        cv::Mat expanded_cylinder_image = cv::Mat::zeros(1000, 2000, CV_8UC3);
-        cv::Size image_size = fisheye_image.size();
-
-        for (int i = 0; i < image_size.height; i++)
-        {
-            for (int j = 0; j < image_size.width; j++)
-            {
-
-                cv::Point2d normalized_coord = FisheyeToNormalCylinder(i, j, intrinsic, distortion_coefficient);
-
-                normalized_coord.x = (normalized_coord.x + 1) * 1000;
-                normalized_coord.y = (normalized_coord.y + 1) * 500;
-
-                if (normalized_coord.x > 0 && normalized_coord.y > 0 && normalized_coord.x < expanded_cylinder_image.cols && normalized_coord.y < expanded_cylinder_image.rows)
-                {
-                    cv::Vec3b color_value = fisheye_image.at<cv::Vec3b>(i, j);
-                    expanded_cylinder_image.at<cv::Vec3b>(normalized_coord) = color_value;
-                }
-            }
-        }
-        LOG(INFO) << "Saving the expanded image."
-                  << std::endl;
-
-        cv::imwrite("cylinder_expanded_image.jpg", expanded_cylinder_image);
+        const double yaw = settings.yaw * CV_PI / 180, pitch = settings.pitch * CV_PI / 180, roll = settings.roll * CV_PI / 180;
+        cv::Mat rotation_yaw = (cv::Mat_<double>(3, 3) << cos(yaw), 0, sin(yaw), 0, 1, 0, -sin(yaw), 0, cos(yaw));
+        cv::Mat rotation_pitch = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, cos(pitch), -sin(pitch), 0, sin(pitch), cos(pitch));
+        cv::Mat rotation_roll = (cv::Mat_<double>(3, 3) << cos(roll), -sin(roll), 0, sin(roll), cos(roll), 0, 0, 0, 1);
+        return rotation_roll * rotation_pitch * rotation_yaw;
     }
 
-    // geometry
-    cv::Point2d FisheyeToNormalCylinder(double u, double v, cv::Mat intrinsic, cv::Mat distortion_coefficient)
+    bool BuildExpansionMap(CameraModelType model_type, const cv::Mat &intrinsic, const cv::Mat &coefficients,
+                           const KBInverseModel &inverse_model, const ExpansionSettings &settings,
+                           cv::Mat &map_x, cv::Mat &map_y)
     {
-        cv::Point2d normal_cylinder_xy;
-        const double &fx = intrinsic.at<double>(0, 0);
-        const double &fy = intrinsic.at<double>(1, 1);
-        const double &cx = intrinsic.at<double>(0, 2);
-        const double &cy = intrinsic.at<double>(1, 2);
-        const double &k1 = distortion_coefficient.at<double>(0, 0);
-        const double &k2 = distortion_coefficient.at<double>(0, 1);
-        const double &k3 = distortion_coefficient.at<double>(0, 2);
-        const double &k4 = distortion_coefficient.at<double>(0, 3);
-        double x_d = (u - cx) / fx;
-        double y_d = (v - cy) / fy;
-        double r_d = std::sqrt(y_d * y_d + x_d * x_d);
-        double phi = atan2(y_d, x_d);
-        double theta = r_d; // equidistance projection, and focal is unit.
-
-        // find suitable theta by least square.
-        double residual = 10000;
-        double theta2 = theta * theta, theta3 = theta2 * theta, theta4 = theta2 * theta2, theta5 = theta4 * theta;
-        double theta6 = theta3 * theta3, theta7 = theta6 * theta, theta8 = theta4 * theta4, theta9 = theta8 * theta;
-        while (residual > 0.0001)
-        {
-            residual = std::pow((r_d - (theta + k1 * theta3 + k2 * theta5 + k3 * theta7 + k4 * theta9)), 2);
-            double delta = (r_d - (theta + k1 * theta3 + k2 * theta5 + k3 * theta7 + k4 * theta9)) / (1 + 3 * k1 * theta2 + 5 * k2 * theta4 + 7 * k3 * theta6 + 9 * k4 * theta8);
-            theta = theta + delta;
-            theta2 = theta * theta;
-            theta3 = theta2 * theta;
-            theta4 = theta2 * theta2;
-            theta5 = theta4 * theta;
-            theta6 = theta3 * theta3;
-            theta7 = theta6 * theta;
-            theta8 = theta4 * theta4;
-            theta9 = theta8 * theta;
-
-            // Bugs for not converge.
-            if (theta > (100 * 3.1415926 / 180))
-            {
-                theta = (100 * 3.1415926 / 180);
-                break;
-            }
-        }
-
-        cv::Mat coord_unit_sphere = cv::Mat::zeros(3, 1, CV_64FC1);
-        coord_unit_sphere.at<double>(0, 0) = sin(theta) * cos(phi);
-        coord_unit_sphere.at<double>(1, 0) = sin(theta) * sin(phi);
-        coord_unit_sphere.at<double>(2, 0) = cos(theta);
-
-        // calculate latitude and longitude from theta and phi.
-        // Note here use the simplified form.
-        // Todo rotate the phi and theta by [0,0,1][0,1,0][1,0,0]
-        cv::Mat rotation = (cv::Mat_<double>(3, 3) << 0, 0, 1, 0, 1, 0, 1, 0, 0);
-        coord_unit_sphere = rotation * coord_unit_sphere;
-
-        // instead of using [theta, phi] in 2d coordinate, the [x,y,z] is in 3-d coordinate.
-        double x_rotated = coord_unit_sphere.at<double>(0, 0);
-        double y_rotated = coord_unit_sphere.at<double>(1, 0);
-        double z_rotated = coord_unit_sphere.at<double>(2, 0);
-
-        double r_rotated = sqrt(x_rotated * x_rotated + y_rotated * y_rotated);
-
-        double longitude = atan2(y_rotated, x_rotated);
-        double latitude = atan2(z_rotated, r_rotated); // bug for pi.
+        bool ok = DispatchCameraModel(model_type, intrinsic, coefficients, inverse_model, [&](const auto &model)
+                                      { BuildEquirectangularMap(model, settings, map_x, map_y); });
+        if (!ok)
+            LOG(ERROR) << "Unknown camera model " << CameraModelName(model_type) << " or unsupported coefficients";
+        return ok;
+    }
 
-        // calculate the normal cylinder coordinate.
-        // normalize by PI and PI/2
-        normal_cylinder_xy.x = longitude / 3.1415926;
-        normal_cylinder_xy.y = 2 * latitude / 3.1415926;
+    bool BuildVignettingGain(CameraModelType model_type, const cv::Mat &intrinsic, const cv::Mat &coefficients,
+                             const KBInverseModel &inverse_model, const VignettingModel &vignetting,
+                             const cv::Mat &map_x, const cv::Mat &map_y, cv::Mat &gain)
+    {
+        bool ok = DispatchCameraModel(model_type, intrinsic, coefficients, inverse_model, [&](const auto &model)
+                                      { BuildGainTable(model, vignetting, map_x, map_y, gain); });
+        if (!ok)
+            LOG(ERROR) << "Unknown camera model " << CameraModelName(model_type) << " or unsupported coefficients";
+        return ok;
+    }
 
-        return normal_cylinder_xy;
+    void FisheyeExpansion(const cv::Mat &fisheye_image, const cv::Mat &map1, const cv::Mat &map2, cv::Mat &expanded_image,
+                          const RemapTiling *tiling)
+    {
+        if (tiling)
+            TiledRemap(fisheye_image, map1, map2, *tiling, expanded_image);
+        else
+            cv::remap(fisheye_image, expanded_image, map1, map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
     }
 }
\ No newline at end of file
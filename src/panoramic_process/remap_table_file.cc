@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <fstream>
+
+#include "base/log.h"
+#include "panoramic_process/remap_table_file.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        const int32_t kRemapTableMagic = 0x54524346; // "FCRT"
+        const int32_t kRemapTableVersion = 1;
+    }
+
+    // layout: magic, version, source width and height, table count, rows and cols of every table,
+    // then the rows of every table, all int32 and float, so the tables are aligned in the mapping.
+    bool WriteRemapTableFile(const std::string &filename, const cv::Size &source_size, const std::vector<cv::Mat> &tables)
+    {
+        std::vector<int32_t> header = {kRemapTableMagic, kRemapTableVersion, source_size.width, source_size.height,
+                                       (int32_t)tables.size()};
+        for (const cv::Mat &table : tables)
+        {
+            if (!table.empty() && table.type() != CV_32FC1)
+            {
+                LOG(ERROR) << "Only CV_32FC1 remap tables are written to " << filename << std::endl;
+                return false;
+            }
+            header.push_back(table.rows);
+            header.push_back(table.cols);
+        }
+
+        std::ofstream file(filename.c_str(), std::ios::binary);
+        file.write((const char *)header.data(), header.size() * sizeof(int32_t));
+        for (const cv::Mat &table : tables)
+        {
+            for (int row = 0; row < table.rows; row++)
+                file.write((const char *)table.ptr<float>(row), table.cols * sizeof(float));
+        }
+        if (!file)
+        {
+            LOG(ERROR) << "Could not write the remap tables to " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool MappedRemapTables::Open(const std::string &filename)
+    {
+        tables_.clear();
+        if (!file_.Open(filename))
+        {
+            LOG(ERROR) << "Could not map the remap table file " << filename << std::endl;
+            return false;
+        }
+
+        const int32_t *header = (const int32_t *)file_.Data();
+        const size_t header_size = 5 * sizeof(int32_t);
+        if (file_.Size() < header_size || header[0] != kRemapTableMagic || header[1] != kRemapTableVersion)
+        {
+            LOG(ERROR) << filename << " is not a remap table file." << std::endl;
+            return false;
+        }
+        source_size_ = cv::Size(header[2], header[3]);
+        const int count = header[4];
+        // the sizes are checked before any product, so a corrupt header cannot wrap the bounds checks.
+        if (source_size_.width <= 0 || source_size_.height <= 0 || count < 0 ||
+            (size_t)count > (file_.Size() - header_size) / (2 * sizeof(int32_t)))
+        {
+            LOG(ERROR) << "Corrupt or truncated remap table file " << filename << std::endl;
+            return false;
+        }
+        size_t offset = header_size + 2 * (size_t)count * sizeof(int32_t);
+
+        for (int i = 0; i < count; i++)
+        {
+            const int rows = header[5 + 2 * i], cols = header[6 + 2 * i];
+            if (rows < 0 || cols < 0 ||
+                (cols > 0 && (size_t)rows > (file_.Size() - offset) / sizeof(float) / (size_t)cols))
+            {
+                LOG(ERROR) << "Corrupt or truncated remap table file " << filename << std::endl;
+                tables_.clear();
+                return false;
+            }
+            const size_t bytes = (size_t)rows * cols * sizeof(float);
+            // the mapping is read-only, the headers must not be written through.
+            tables_.push_back(bytes ? cv::Mat(rows, cols, CV_32FC1, (void *)(file_.Data() + offset)) : cv::Mat());
+            offset += bytes;
+        }
+        return true;
+    }
+}
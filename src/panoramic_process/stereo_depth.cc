@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cmath>
+
+#include "base/log.h"
+#include "calibration/camera_models.h"
+#include "panoramic_process/fused_remap.h"
+#include "panoramic_process/remap_kernels.h"
+#include "panoramic_process/stereo_depth.h"
+
+namespace fishcat
+{
+    namespace
+    {
+        // rows matched above and below every strip, so the vertical aggregation paths are not cut at the seams.
+        const int kStripMargin = 32;
+        const int kRectificationTile = 64;
+    }
+
+    bool ReadStereoRig(const std::string &filename, const cv::Size &image_size, StereoRig &rig)
+    {
+        cv::FileStorage fs(filename, cv::FileStorage::READ);
+        if (!fs.isOpened())
+        {
+            LOG(ERROR) << "Could not open the stereo camera file: " << filename << std::endl;
+            return false;
+        }
+        fs["in1_intrinsic"] >> rig.left_intrinsic;
+        fs["in1_coff"] >> rig.left_coefficients;
+        fs["in2_intrinsic"] >> rig.right_intrinsic;
+        fs["in2_coff"] >> rig.right_coefficients;
+        fs["rotation"] >> rig.rotation;
+        fs["translation"] >> rig.translation;
+        if (rig.left_intrinsic.empty() || rig.left_coefficients.empty() || rig.right_intrinsic.empty() ||
+            rig.right_coefficients.empty() || rig.rotation.empty() || rig.translation.empty())
+        {
+            LOG(ERROR) << "The stereo camera file " << filename << " misses a camera or the extrinsics." << std::endl;
+            return false;
+        }
+
+        // a rotation vector is accepted as well as a matrix.
+        if (rig.rotation.total() == 3)
+            cv::Rodrigues(rig.rotation, rig.rotation);
+        rig.rotation.convertTo(rig.rotation, CV_64F);
+        rig.translation.convertTo(rig.translation, CV_64F);
+        if (rig.translation.total() != 3 || cv::norm(rig.translation) < 1e-9)
+        {
+            LOG(ERROR) << "The stereo camera file " << filename << " has no baseline, the translation must be nonzero." << std::endl;
+            return false;
+        }
+        rig.translation = rig.translation.reshape(1, 3);
+
+        rig.image_size = image_size;
+        rig.left_inverse = FitKBInverseModel(rig.left_intrinsic, rig.left_coefficients, image_size);
+        rig.right_inverse = FitKBInverseModel(rig.right_intrinsic, rig.right_coefficients, image_size);
+        return true;
+    }
+
+    cv::Mat StereoRectificationRotation(const cv::Mat &rotation, const cv::Mat &translation)
+    {
+        // the right center in the left frame is the x axis, the z axis is the mean optical axis.
+        cv::Mat x_axis = -rotation.t() * translation;
+        x_axis /= cv::norm(x_axis);
+        cv::Mat z_axis = (cv::Mat_<double>(3, 1) << 0, 0, 1) + rotation.row(2).t();
+        z_axis -= x_axis.dot(z_axis) * x_axis;
+        z_axis /= cv::norm(z_axis);
+        cv::Mat y_axis = z_axis.cross(x_axis);
+
+        cv::Mat rectification(3, 3, CV_64F);
+        x_axis.copyTo(rectification.col(0));
+        y_axis.copyTo(rectification.col(1));
+        z_axis.copyTo(rectification.col(2));
+        return rectification;
+    }
+
+    StereoDepthEngine::StereoDepthEngine(const StereoRig &rig, const StereoSettings &settings)
+        : settings_(settings), baseline_(cv::norm(rig.translation))
+    {
+        const cv::Mat left_rectification = StereoRectificationRotation(rig.rotation, rig.translation);
+        const cv::Mat right_rectification = rig.rotation * left_rectification;
+        BuildEpipolarMap(KannalaBrandtModel(rig.left_intrinsic, rig.left_coefficients, rig.left_inverse),
+                         left_rectification, settings_, left_map_x_, left_map_y_);
+        BuildEpipolarMap(KannalaBrandtModel(rig.right_intrinsic, rig.right_coefficients, rig.right_inverse),
+                         right_rectification, settings_, right_map_x_, right_map_y_);
+        BuildRemapTiling(left_map_x_, left_map_y_, rig.image_size, kRectificationTile, left_tiling_);
+        BuildRemapTiling(right_map_x_, right_map_y_, rig.image_size, kRectificationTile, right_tiling_);
+
+        const double alpha_step = settings_.horizontal_fov * CV_PI / 180 / settings_.output_size.width;
+        column_alpha_.resize(settings_.output_size.width);
+        for (int col = 0; col < settings_.output_size.width; col++)
+            column_alpha_[col] = -0.5 * settings_.horizontal_fov * CV_PI / 180 + (col + 0.5) * alpha_step;
+
+        LOG(INFO) << "Stereo rectification of " << settings_.output_size.width << "x" << settings_.output_size.height
+                  << " over a baseline of " << baseline_ << "." << std::endl;
+    }
+
+    void StereoDepthEngine::Rectify(const cv::Mat &left, const cv::Mat &right,
+                                    cv::Mat &left_rectified, cv::Mat &right_rectified) const
+    {
+        // the matcher works on gray, which the fused kernel writes in the gather pass.
+        FusedRemap(left, left_map_x_, left_map_y_, REMAP_GRAY, left_rectified, cv::Mat(), &left_tiling_);
+        FusedRemap(right, right_map_x_, right_map_y_, REMAP_GRAY, right_rectified, cv::Mat(), &right_tiling_);
+    }
+
+    void StereoDepthEngine::ComputeDisparity(const cv::Mat &left_rectified, const cv::Mat &right_rectified,
+                                             cv::Mat &disparity) const
+    {
+        const int rows = left_rectified.rows;
+        const int strips = std::max(1, std::min(settings_.strips > 0 ? settings_.strips : cv::getNumThreads(), rows));
+        const int channels = left_rectified.channels();
+        disparity.create(left_rectified.size(), CV_16S);
+
+        // the 3-way matcher is parallel itself, the strips run on the OpenCV pool so its nested loop runs
+        // serially inside a strip instead of oversubscribing the cores.
+        cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range)
+                          {
+                              for (int strip = range.start; strip < range.end; strip++)
+                              {
+                                  const int begin = rows * strip / strips, end = rows * (strip + 1) / strips;
+                                  const int padded_begin = std::max(0, begin - kStripMargin);
+                                  const int padded_end = std::min(rows, end + kStripMargin);
+
+                                  // the 3-way mode is the single pass variant of SGBM, faster and lighter than the full 8 paths.
+                                  cv::Ptr<cv::StereoSGBM> matcher = cv::StereoSGBM::create(
+                                      0, settings_.num_disparities, settings_.block_size,
+                                      8 * channels * settings_.block_size * settings_.block_size,
+                                      32 * channels * settings_.block_size * settings_.block_size,
+                                      1, 63, 10, 100, 2, cv::StereoSGBM::MODE_SGBM_3WAY);
+                                  cv::Mat strip_disparity;
+                                  matcher->compute(left_rectified.rowRange(padded_begin, padded_end),
+                                                   right_rectified.rowRange(padded_begin, padded_end), strip_disparity);
+                                  strip_disparity.rowRange(begin - padded_begin, end - padded_begin)
+                                      .copyTo(disparity.rowRange(begin, end));
+                              }
+                          },
+                          strips);
+    }
+
+    void StereoDepthEngine::DisparityToDepth(const cv::Mat &disparity, cv::Mat &depth) const
+    {
+        const double alpha_step = settings_.horizontal_fov * CV_PI / 180 / settings_.output_size.width;
+        depth.create(disparity.size(), CV_32F);
+
+#pragma omp parallel for
+        for (int row = 0; row < disparity.rows; row++)
+        {
+            const short *disparity_row = disparity.ptr<short>(row);
+            float *depth_row = depth.ptr<float>(row);
+            for (int col = 0; col < disparity.cols; col++)
+            {
+                // the two rays and the baseline form a triangle of apex angle alpha_left - alpha_right.
+                const double angle = disparity_row[col] / 16.0 * alpha_step;
+                if (disparity_row[col] <= 0 || angle >= CV_PI)
+                {
+                    depth_row[col] = 0;
+                    continue;
+                }
+                // rays crossing behind the right center have no valid triangle either.
+                depth_row[col] = (float)std::max(0.0, baseline_ * std::cos(column_alpha_[col] - angle) / std::sin(angle));
+            }
+        }
+    }
+
+    void StereoDepthEngine::Process(const cv::Mat &left, const cv::Mat &right, cv::Mat &disparity, cv::Mat &depth) const
+    {
+        cv::Mat left_rectified, right_rectified;
+        Rectify(left, right, left_rectified, right_rectified);
+        ComputeDisparity(left_rectified, right_rectified, disparity);
+        DisparityToDepth(disparity, depth);
+    }
+}